@@ -0,0 +1,517 @@
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_FFTW
+#include <fftw3.h>
+#endif
+
+#include "fft.hh"
+
+using namespace std;
+using namespace chrono;
+
+namespace po = boost::program_options;
+
+// Runs the same lengths, FftJob::populate() data and batch shape through
+// each engine: clFFT on the GPU, clFFT on the CPU OpenCL device, and FFTW
+// when built with it. Every engine transforms in place, N reals in and
+// N / 2 + 1 interleaved complex bins out, so spectra compare directly; the
+// first engine that runs a length is the reference for the others.
+
+class Engine {
+public:
+    Engine(const string& name) : _name(name) {}
+    virtual ~Engine() {}
+
+    const string&       name()          { return _name; }
+
+    virtual bool        init(size_t size, int batch) = 0;
+    virtual cl_float*   data(int index) = 0;
+
+    // the first count of the batch, waits for completion
+    virtual bool        forward(int count) = 0;
+    virtual bool        backward(int count) = 0;
+
+    virtual void        shutdown() = 0;
+
+protected:
+    string      _name;
+};
+
+class ClfftEngine : public Engine {
+public:
+    ClfftEngine(const string& name, Fft::Device device)
+      : Engine(name), _device(device), _fft(NULL) {}
+
+    bool init(size_t size, int batch) {
+        _fft = new Fft(size, _device, batch);
+        // the true N point transform at every length, as FFTW computes
+        _fft->set_policy(Fft::BLUESTEIN);
+        if (!_fft->init()) {
+            shutdown();
+            return false;
+        }
+        for (int i = 0; i < batch; ++i) {
+            _jobs.push_back(_fft->create_job(0, 0));
+        }
+        return true;
+    }
+
+    cl_float* data(int index) { return _jobs[index]->data(); }
+
+    bool forward(int count) {
+        for (int i = 0; i < count; ++i) {
+            if (!_fft->forward(*_jobs[i]))
+                return false;
+        }
+        _fft->wait_all();
+        return true;
+    }
+
+    bool backward(int count) {
+        for (int i = 0; i < count; ++i) {
+            if (!_fft->backward(*_jobs[i]))
+                return false;
+        }
+        _fft->wait_all();
+        return true;
+    }
+
+    void shutdown() {
+        for (auto job : _jobs) {
+            delete job;
+        }
+        _jobs.clear();
+        if (NULL != _fft) {
+            _fft->shutdown();
+            delete _fft;
+            _fft = NULL;
+        }
+    }
+
+private:
+    Fft::Device         _device;
+    Fft*                _fft;
+    vector<FftJob*>     _jobs;
+};
+
+#ifdef HAVE_FFTW
+// Measured plans for a lone transform and for the whole batch, each
+// row padded to 2 * (N / 2 + 1) floats as in place r2c needs
+class FftwEngine : public Engine {
+public:
+    FftwEngine(int threads)
+      : Engine("fftw"), _threads(threads), _buffer(NULL) {
+        memset(_plans, 0, sizeof(_plans));
+    }
+
+    bool init(size_t size, int batch) {
+        int n = size;
+        _size  = size;
+        _batch = batch;
+        _row   = 2 * (size / 2 + 1);
+        _buffer = fftwf_alloc_real(batch * _row);
+        if (NULL == _buffer)
+            return false;
+
+        fftwf_plan_with_nthreads(_threads);
+        fftwf_complex* bins = (fftwf_complex*) _buffer;
+        for (int single = 0; single < 2; ++single) {
+            int count = single ? 1 : batch;
+            _plans[single][0] = fftwf_plan_many_dft_r2c(1, &n, count, _buffer, NULL, 1, _row,
+                                                        bins, NULL, 1, _row / 2, FFTW_MEASURE);
+            _plans[single][1] = fftwf_plan_many_dft_c2r(1, &n, count, bins, NULL, 1, _row / 2,
+                                                        _buffer, NULL, 1, _row, FFTW_MEASURE);
+            if (NULL == _plans[single][0] || NULL == _plans[single][1]) {
+                cerr << "Error: no FFTW plan for length " << size << endl;
+                shutdown();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    cl_float* data(int index) { return _buffer + index * _row; }
+
+    bool forward(int count) {
+        fftwf_execute(plan(count, 0));
+        return true;
+    }
+
+    // FFTW leaves the inverse unnormalized, clFFT scales by 1 / N
+    bool backward(int count) {
+        fftwf_execute(plan(count, 1));
+        float scale = 1.0f / _size;
+        for (size_t i = 0; i < count * _row; ++i) {
+            _buffer[i] *= scale;
+        }
+        return true;
+    }
+
+    void shutdown() {
+        for (auto& single : _plans) {
+            for (auto& plan : single) {
+                if (NULL != plan)
+                    fftwf_destroy_plan(plan);
+                plan = NULL;
+            }
+        }
+        if (NULL != _buffer)
+            fftwf_free(_buffer);
+        _buffer = NULL;
+    }
+
+private:
+    fftwf_plan plan(int count, int direction) {
+        return _plans[1 == count && 1 != _batch ? 1 : 0][direction];
+    }
+
+private:
+    int         _threads;
+    size_t      _size;
+    int         _batch;
+    size_t      _row;
+    float*      _buffer;
+    fftwf_plan  _plans[2][2];       // [single][inverse]
+};
+#endif
+
+struct Result {
+    string      engine;
+    double      rate;               // transforms/s
+    double      latency;            // μs, median of lone transforms
+    double      sqer;               // dB after a round trip
+    double      error;              // RMS relative to the reference spectra
+    bool        agree;
+};
+
+void fill(Engine& engine, vector<FftJob*>& sources, int count) {
+    for (int i = 0; i < count; ++i) {
+        memcpy(engine.data(i), sources[i]->data(), sources[i]->size() * sizeof(cl_float));
+    }
+}
+
+bool measure(Engine& engine, vector<FftJob*>& sources, long count,
+             vector<cl_float>& reference, double tolerance, Result& result) {
+
+    size_t size     = sources[0]->size();
+    int    batch    = sources.size();
+    size_t spectrum = 2 * (size / 2 + 1);
+
+    result.engine = engine.name();
+
+    // spectra against the reference, or become it
+    fill(engine, sources, batch);
+    if (!engine.forward(batch))
+        return false;
+
+    vector<cl_float> spectra;
+    for (int i = 0; i < batch; ++i) {
+        spectra.insert(spectra.end(), engine.data(i), engine.data(i) + spectrum);
+    }
+    if (reference.empty())
+        reference = spectra;
+
+    double error  = 0;
+    double energy = 0;
+    for (size_t i = 0; i < spectra.size(); ++i) {
+        error  += pow(spectra[i] - reference[i], 2);
+        energy += pow(reference[i], 2);
+    }
+    result.error = 0 == energy ? sqrt(error) : sqrt(error / energy);
+    result.agree = result.error <= tolerance;
+
+    // round trip
+    fill(engine, sources, batch);
+    if (!engine.forward(batch) || !engine.backward(batch))
+        return false;
+
+    double signal = 0;
+    double noise  = 0;
+    for (int i = 0; i < batch; ++i) {
+        FftJob inverse(engine.data(i), size, spectrum);
+        signal += sources[i]->signal_energy();
+        noise  += sources[i]->quant_error_energy(inverse);
+    }
+    result.sqer = 10.0 * log10(signal / noise);
+
+    // throughput with the batch in flight, refills untimed
+    nanoseconds total(0);
+    for (long done = 0; done < count; done += batch) {
+        fill(engine, sources, batch);
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        if (!engine.forward(batch))
+            return false;
+        total += duration_cast<nanoseconds>(high_resolution_clock::now() - start);
+    }
+    result.rate = count / (total.count() / 1e9);
+
+    // latency of a transform submitted alone
+    vector<double> latency;
+    for (long done = 0; done < max(count / batch, 1L); ++done) {
+        fill(engine, sources, 1);
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        if (!engine.forward(1))
+            return false;
+        latency.push_back(duration_cast<nanoseconds>(high_resolution_clock::now() - start).count() / 1000.0);
+    }
+    sort(latency.begin(), latency.end());
+    result.latency = latency[latency.size() / 2];
+
+    return true;
+}
+
+vector<size_t> parse_sizes(const string& list) {
+    vector<size_t> sizes;
+    stringstream   stream(list);
+    string         item;
+    while (getline(stream, item, ',')) {
+        sizes.push_back(stoul(item));
+    }
+    return sizes;
+}
+
+int main(int ac, char* av[]) {
+
+    FftJob::TestData    test_data   = FftJob::RANDOM;
+    double              mean        = 0.5;
+    double              std         = 0.2;
+    size_t              min_size    = 256;
+    size_t              max_size    = 65536;
+    string              size_list;
+    int                 parallel    = 16;
+    long                count       = 1024;
+#ifdef HAVE_FFTW
+    int                 threads     = max(thread::hardware_concurrency(), 1u);
+#endif
+    double              tolerance   = 1e-4;
+    string              engine_list = "fftw,gpu,cpu";
+    string              csv;
+
+    try {
+        po::options_description desc("Allowed options");
+
+        desc.add_options()
+        ("help,h",         "Produce help message")
+        ("min-size",       po::value<size_t>(), "Smallest power of two length [256]")
+        ("size,s",         po::value<size_t>(), "Largest power of two length [65536]")
+        ("sizes",          po::value<string>(), "Comma separated lengths instead of powers of two")
+        ("jobs,j",         po::value<int>(), "Transforms in a batch [16]")
+        ("loops,l",        po::value<long>(), "Transforms timed per engine and length [1024]")
+        ("engines,e",      po::value<string>(), "Comma separated engines: fftw, gpu, cpu [fftw,gpu,cpu]")
+        ("tolerance",      po::value<double>(), "Largest RMS error against the reference [1e-4]")
+        ("csv",            po::value<string>(), "Also write the results to this CSV file")
+        ("periodic,p",     "Use a periodic data set")
+        ("random,r",       "Use a gaussian distributed random data set")
+        ("mean,m",         po::value<double>(), "Mean for random data")
+        ("deviation,d",    po::value<double>(), "Standard deviation for random data");
+
+#ifdef HAVE_FFTW
+        desc.add_options()
+        ("threads,t",      po::value<int>(), "FFTW threads [hardware threads]");
+#endif
+
+        po::variables_map vm;
+        po::store(po::parse_command_line(ac, av, desc), vm);
+        po::notify(vm);
+
+        if (vm.count("help")) {
+            cout << desc << "\n";
+            return 1;
+        }
+
+        if (vm.count("min-size")) {
+            min_size = vm["min-size"].as<size_t>();
+        }
+
+        if (vm.count("size")) {
+            max_size = vm["size"].as<size_t>();
+        }
+
+        if (vm.count("sizes")) {
+            size_list = vm["sizes"].as<string>();
+        }
+
+        if (vm.count("jobs")) {
+            parallel = max(vm["jobs"].as<int>(), 1);
+        }
+
+        if (vm.count("loops")) {
+            count = vm["loops"].as<long>();
+        }
+
+        if (vm.count("engines")) {
+            engine_list = vm["engines"].as<string>();
+        }
+
+#ifdef HAVE_FFTW
+        if (vm.count("threads")) {
+            threads = max(vm["threads"].as<int>(), 1);
+        }
+#endif
+
+        if (vm.count("tolerance")) {
+            tolerance = vm["tolerance"].as<double>();
+        }
+
+        if (vm.count("csv")) {
+            csv = vm["csv"].as<string>();
+        }
+
+        if (vm.count("periodic")) {
+            test_data = FftJob::PERIODIC;
+        }
+
+        if (vm.count("random")) {
+            test_data = FftJob::RANDOM;
+        }
+
+        if (vm.count("mean")) {
+            mean = vm["mean"].as<double>();
+        }
+
+        if (vm.count("deviation")) {
+            std = vm["deviation"].as<double>();
+        }
+
+    } catch (exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    } catch (...) {
+        cerr << "Unknown error" << endl;
+        return 1;
+    }
+
+    // whole batches
+    count = max((count + parallel - 1) / parallel * parallel, (long) parallel);
+
+    vector<size_t> sizes;
+    try {
+        sizes = parse_sizes(size_list);
+    } catch (exception& e) {
+        cerr << "Error: bad --sizes " << size_list << endl;
+        return 1;
+    }
+    if (size_list.empty()) {
+        for (size_t size = min_size; size <= max_size; size *= 2)
+            sizes.push_back(size);
+    }
+
+    vector<Engine*> engines;
+    stringstream    names(engine_list);
+    string          name;
+    while (getline(names, name, ',')) {
+        if ("gpu" == name) {
+            engines.push_back(new ClfftEngine("clfft-gpu", Fft::GPU));
+        } else if ("cpu" == name) {
+            engines.push_back(new ClfftEngine("clfft-cpu", Fft::CPU));
+        } else if ("fftw" == name) {
+#ifdef HAVE_FFTW
+            engines.push_back(new FftwEngine(threads));
+#else
+            cerr << "Built without FFTW, skipping it" << endl;
+#endif
+        } else {
+            cerr << "Error: unknown engine " << name << endl;
+            return 1;
+        }
+    }
+    if (engines.empty())
+        return 1;
+
+#ifdef HAVE_FFTW
+    fftwf_init_threads();
+#endif
+
+    ofstream csv_out;
+    if (!csv.empty()) {
+        csv_out.open(csv);
+        if (!csv_out) {
+            cerr << "Error: cannot write " << csv << endl;
+            return 1;
+        }
+        csv_out << "length,engine,transforms_per_s,msamples_per_s,latency_us,sqer_db,error,agree" << endl;
+    }
+
+    cout << "Batch:      " << parallel << endl;
+    cout << "Transforms: " << count << " per engine and length" << endl;
+#ifdef HAVE_FFTW
+    cout << "FFTW:       " << threads << " threads, measured plans" << endl;
+#endif
+    cout << "Reference:  " << engines[0]->name() << " where it runs, tolerance " << tolerance << endl;
+    cout << endl;
+    cout << left << setw(9) << "Length" << setw(12) << "Engine" << setw(13) << "FFT/s"
+         << setw(13) << "Msamples/s" << setw(14) << "Latency μs" << setw(10) << "SQER dB"
+         << "Error" << endl;
+
+    bool agree = true;
+    for (auto size : sizes) {
+
+        vector<FftJob*> sources;
+        for (int i = 0; i < parallel; ++i) {
+            sources.push_back(new FftJob(size, mean, std));
+            sources.back()->populate(test_data);
+        }
+
+        vector<cl_float> reference;
+        vector<Result>   results;
+        for (auto engine : engines) {
+            if (!engine->init(size, parallel))
+                continue;
+
+            Result result;
+            bool ok = measure(*engine, sources, count, reference, tolerance, result);
+            engine->shutdown();
+            if (ok)
+                results.push_back(result);
+            else
+                cerr << "Error: " << engine->name() << " failed at length " << size << endl;
+        }
+
+        // the fastest engine at this length is starred
+        double best = 0;
+        for (auto& result : results)
+            best = max(best, result.rate);
+
+        for (auto& result : results) {
+            cout << setw(9) << size << setw(12) << result.engine << setprecision(5)
+                 << setw(13) << result.rate << setw(13) << result.rate * size / 1e6
+                 << setw(13) << result.latency << setw(10) << setprecision(4) << result.sqer
+                 << setprecision(3) << result.error << (result.agree ? "" : " MISMATCH")
+                 << (result.rate == best && 1 < results.size() ? " *" : "") << endl;
+
+            if (csv_out)
+                csv_out << size << "," << result.engine << "," << result.rate << ","
+                        << result.rate * size / 1e6 << "," << result.latency << ","
+                        << result.sqer << "," << result.error << "," << result.agree << endl;
+
+            agree = agree && result.agree;
+        }
+
+        for (auto source : sources) {
+            delete source;
+        }
+    }
+    cout << right;
+
+    for (auto engine : engines) {
+        delete engine;
+    }
+#ifdef HAVE_FFTW
+    fftwf_cleanup_threads();
+#endif
+
+    if (!agree)
+        cerr << "Error: engines disagree beyond the tolerance" << endl;
+    return agree ? 0 : 1;
+}
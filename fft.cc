@@ -1,5 +1,8 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <cstring>
+#include <mutex>
 
 #include "fft.hh"
 
@@ -11,122 +14,272 @@
       return false;                             \
     }
 
+// clFFT state is process wide: set up for the first Fft that needs it and
+// torn down after the last, so one instance shutting down never destroys
+// the plans of the others
+static std::mutex _clfft_lock;
+static int        _clfft_users = 0;
 
 Fft::Fft(size_t fft_size, Device device, int parallel)
   : _fft_size(fft_size),
     _device_type(device),
-    _parallel(parallel)
+    _parallel(parallel),
+    _policy(PAD),
+    _plan_size(0),
+    _channels(1),
+    _stride(1),
+    _transfer(FLOAT),
+    _pack_output(false),
+    _fission(NONE),
+    _fission_units(0),
+    _mem_budget(0),
+    _next_queue(0),
+    _next_job(0),
+    _cache(NULL),
+    _trace(NULL),
+    _metrics(NULL),
+    _startup_ms(0),
+    _clfft_entries(0),
+    _clfft_held(false)
 {
+    set_policy(PAD);
 }
 
 bool Fft::init() {
+    auto start = std::chrono::steady_clock::now();
 
-    if (select_platform() && 
-        setup_cl() &&
-        setup_clFft() && 
-        setup_forward() &&
-        setup_backward() && 
-        setup_buffers())
-        return true;
-    return false;
+    if (is_strided() && is_bluestein()) {
+        std::cerr << "Error: interleaved channels need a length clFFT can plan" << std::endl;
+        return false;
+    }
+
+    if (!init_cl())
+        return false;
+
+    // spread the buffer slots and the memory budget over the lanes
+    int    lanes  = _queues.size();
+    size_t budget = std::min(_mem_budget, get_device_memory()) / lanes;
+    for (int i = 0; i < lanes; ++i) {
+        int slots = _parallel / lanes + (i < _parallel % lanes ? 1 : 0);
+        if (!_queues[i]->init(std::max(slots, 1), budget))
+            return false;
+    }
+
+    auto finish = std::chrono::steady_clock::now();
+    _startup_ms = std::chrono::duration<double, std::milli>(finish - start).count();
+    return true;
+}
+
+bool Fft::init_cl() {
+
+    if (!select_platform() || !setup_devices())
+        return false;
+
+    for (size_t i = 0; i < _sub_devices.size(); ++i) {
+        _queues.push_back(new FftQueue(*this, i, _platform, _sub_devices[i]));
+        if (!_queues.back()->setup_cl())
+            return false;
+    }
+
+    // clFFT picks up its cache location when the plans are baked
+    if (NULL != _cache) {
+        _cache->use_for_clfft();
+        _clfft_entries = _cache->count_clfft_entries();
+    }
+
+    return setup_clFft();
+}
+
+void Fft::set_transfer(Transfer transfer, bool pack_output) {
+    _transfer    = transfer;
+    _pack_output = pack_output;
+}
+
+bool Fft::is_packed() {
+    return FLOAT != _transfer || _pack_output;
+}
+
+void Fft::set_policy(Policy policy) {
+    _policy = policy;
+
+    if (0 == _fft_size || is_fast_size(_fft_size))
+        _plan_size = _fft_size;
+    else if (PAD == policy)
+        _plan_size = next_fast_size(_fft_size);
+    else
+        _plan_size = next_fast_size(2 * _fft_size - 1);
+}
+
+void Fft::set_channels(int channels, int stride) {
+    _channels = std::max(channels, 1);
+    _stride   = std::max(stride, _channels);
+}
+
+// The padded spectrum has plan size bins, Bluestein returns exactly N.
+// Interleaved jobs hold the padded frames or every channel's spectrum.
+size_t Fft::get_job_capacity() {
+    size_t length = is_bluestein() ? _fft_size : _plan_size;
+    return std::max(_channels * 2 * (length / 2 + 1), _plan_size * _stride);
+}
+
+size_t Fft::get_input_count(clfftDirection direction) {
+    return CLFFT_FORWARD == direction ? _fft_size * _stride : get_spectra_count();
+}
+
+size_t Fft::get_output_count(clfftDirection direction) {
+    if (CLFFT_FORWARD == direction)
+        return get_spectra_count();
+    return is_bluestein() ? _fft_size : _plan_size * _stride;
+}
+
+// hermitian floats of all channels
+size_t Fft::get_spectra_count() {
+    size_t length = is_bluestein() ? _fft_size : _plan_size;
+    return _channels * 2 * (length / 2 + 1);
+}
+
+bool Fft::is_fast_size(size_t size) {
+    if (0 == size)
+        return false;
+    for (size_t radix : {2, 3, 5, 7}) {
+        while (0 == size % radix)
+            size /= radix;
+    }
+    return 1 == size;
+}
+
+size_t Fft::next_fast_size(size_t size) {
+    while (!is_fast_size(size))
+        ++size;
+    return size;
+}
+
+void Fft::set_cache(const std::string& dir) {
+    delete _cache;
+    _cache = dir.empty() ? NULL : new FftCache(dir);
+}
+
+bool Fft::is_warm_start() {
+    if (NULL == _cache || !_cache->enabled())
+        return false;
+    return 0 == _cache->get_misses() && 
+           _clfft_entries == _cache->count_clfft_entries() && 0 < _clfft_entries;
+}
+
+void Fft::set_fission(Fission fission, int units) {
+    _fission       = fission;
+    _fission_units = units;
 }
 
 void Fft::shutdown() {
     
-    if (_buffers.empty()) {
-        for (int i = _parallel-1; 0 <= i; --i) {
-            _buffers.at(i)->release();
-            _buffers.pop_back();
-        }
-        
+    for (auto queue : _queues) {
+        queue->shutdown();
+        delete queue;
     }
+    _queues.clear();
     
-    // Release clFFT library. 
-    clfftTeardown();
+    // Release clFFT library once no other instance uses it
+    if (_clfft_held) {
+        std::lock_guard<std::mutex> guard(_clfft_lock);
+        if (0 == --_clfft_users)
+            clfftTeardown();
+        _clfft_held = false;
+    }
     
     // Release OpenCL working objects. 
-    clReleaseCommandQueue(_queue);
-    clReleaseContext(_context);
+    if (NONE != _fission) {
+        for (auto device : _sub_devices)
+            clReleaseDevice(device);
+    }
+    _sub_devices.clear();
+
+    delete _cache;
+    _cache = NULL;
 }
 
 bool Fft::forward(FftJob& job) {
-    cl_int err = 0;
-   
-    cl_event write = 0;
-    cl_event read = 0;
-    cl_event transform = 0;
-
-    // get buffer (may block)
-    FftBuffer* buffer = get_buffer();
-    if (NULL == buffer)
-        return NULL;
-    buffer->set_job(&job);
-
-    // Enqueue write tab array into _local_buffers[0]
-    err = clEnqueueWriteBuffer(_queue, buffer->data(), CL_FALSE, 0, 
-                                buffer->size(), buffer->job_data(), 0, NULL, &write);
-    CHECK("clEnqueueWriteBuffer");
-
-    // Enqueue the FFT
-    err = clfftEnqueueTransform(_forward, CLFFT_FORWARD, 1, &_queue, 1, &write, &transform,
-                                 buffer->data_addr(), NULL, buffer->temp());
-    CHECK("clEnqueueTransform");
-
-    // Copy result to input array
-    err = clEnqueueReadBuffer(_queue, buffer->data(), CL_FALSE, 0,
-                               buffer->size(), buffer->job_data(), 1, &transform, &read);
-    CHECK("clEnqueueReadBuffer");
-
-    buffer->set_wait(read);
+    return transform(job, CLFFT_FORWARD);
+}
 
-    return true;
+bool Fft::backward(FftJob& job) {
+    return transform(job, CLFFT_BACKWARD);
 }
 
+bool Fft::transform(FftJob& job, clfftDirection direction) {
+    FftTrace::Span span(_trace, "submit");
 
-bool Fft::backward(FftJob& job) {
-    cl_int err = 0;
-   
-    cl_event write = 0;
-    cl_event read = 0;
-    cl_event transform = 0;
-
-    // get buffer (may block)
-    FftBuffer* buffer = get_buffer();
-    if (NULL == buffer)
-        return NULL;
-    buffer->set_job(&job);
-
-    // Enqueue write tab array into _local_buffers[0]
-    err = clEnqueueWriteBuffer(_queue, buffer->data(), CL_FALSE, 0, 
-                                buffer->size(), buffer->job_data(), 0, NULL, &write);
-    CHECK("clEnqueueWriteBuffer");
-
-    // Enqueue the FFT
-    err = clfftEnqueueTransform(_backward, CLFFT_BACKWARD, 1, &_queue, 1, &write, &transform,
-                                 buffer->data_addr(), NULL, buffer->temp());
-    CHECK("clEnqueueTransform");
-
-    // Copy result to input array
-    err = clEnqueueReadBuffer(_queue, buffer->data(), CL_FALSE, 0,
-                               buffer->size(), buffer->job_data(), 1, &transform, &read);
-    CHECK("clEnqueueReadBuffer");
-
-    buffer->set_wait(read);
+    if (job.stride() != _stride || job.channels() != _channels) {
+        std::cerr << "Error: job of " << job.channels() << " channels, stride " << job.stride()
+                  << ", for a transform of " << _channels << ", stride " << _stride << std::endl;
+        return false;
+    }
+
+    FftQueue* queue = select_queue(job);
+    if (NULL == queue || !queue->transform(job, direction))
+        return false;
 
+    if (NULL != _metrics)
+        _metrics->add(FftMetrics::SUBMITTED);
     return true;
 }
 
+bool Fft::flush() {
+    bool ok = true;
+    for (auto queue : _queues) {
+        ok = queue->flush() && ok;
+    }
+    return ok;
+}
+
 void Fft::wait_all() {
-    for (auto buffer : _buffers) {
-        if (buffer->in_use())
-            buffer->wait();
+    for (auto queue : _queues) {
+        queue->wait_all();
     }
 }
 
+// Jobs are dealt round robin over the lanes, with memory from that lane
+FftJob* Fft::create_job(double mean, double std) {
+    FftQueue* queue = _queues.at(_next_job++ % _queues.size());
+
+    size_t capacity = get_job_capacity();
+    cl_float* data = queue->alloc_host(capacity);
+    if (NULL == data) {
+        FftJob* job = new FftJob(_fft_size, mean, std, capacity);
+        job->set_layout(_channels, _stride);
+        return job;
+    }
+
+    FftJob* job = new FftJob(data, _fft_size, capacity, mean, std);
+    job->set_layout(_channels, _stride);
+    job->set_lane(queue->get_index());
+    return job;
+}
+
 size_t Fft::get_temp_buffer_size() {
-    size_t size = 0;
-    int status = clfftGetTmpBufSize(_forward, &size);
-    return 0 == status ? size : 0;
+    return _queues.at(0)->get_temp_buffer_size();
+}
+
+int Fft::get_slots() {
+    int slots = 0;
+    for (auto queue : _queues)
+        slots += queue->get_slots();
+    return slots;
+}
+
+size_t Fft::get_slot_bytes() {
+    return _queues.at(0)->get_slot_bytes();
+}
+
+size_t Fft::get_shared_bytes() {
+    size_t bytes = 0;
+    for (auto queue : _queues)
+        bytes += queue->get_shared_bytes();
+    return bytes;
+}
+
+size_t Fft::get_device_memory() {
+    return _queues.at(0)->get_device_memory();
 }
 
 bool Fft::select_platform() {
@@ -153,7 +306,7 @@ bool Fft::select_platform() {
     CHECK("clGetPlatformIds - list of platforms");
     
     // find a platform supporting our device type
-    for (uint i = 0; i < platform_count; ++i) {
+    for (uint i = 0; i < platform_count && i < 5; ++i) {
         err = clGetDeviceIDs(platform[i], type, 1, &_device, NULL);
         if (err == CL_SUCCESS) {
             _platform = platform[i];
@@ -164,17 +317,35 @@ bool Fft::select_platform() {
     return false;
 }
 
-bool Fft::setup_cl() {
+bool Fft::setup_devices() {
     cl_int err = 0;
+    cl_device_partition_property props[3] = {0, 0, 0};
 
-    // Setup context
-    cl_context_properties props[3] = {CL_CONTEXT_PLATFORM, (cl_context_properties) _platform, 0};
-    _context = clCreateContext(props, 1, &_device, NULL, NULL, &err);
-    CHECK("clCreateContext");
+    switch (_fission) {
+    case NONE:
+        _sub_devices.push_back(_device);
+        return true;
+    case NUMA:
+        props[0] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+        props[1] = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+        break;
+    case L3:
+        props[0] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+        props[1] = CL_DEVICE_AFFINITY_DOMAIN_L3_CACHE;
+        break;
+    case EQUAL:
+        props[0] = CL_DEVICE_PARTITION_EQUALLY;
+        props[1] = _fission_units;
+        break;
+    }
+
+    cl_uint count = 0;
+    err = clCreateSubDevices(_device, props, 0, NULL, &count);
+    CHECK("clCreateSubDevices - count");
 
-    // Setup queues
-    _queue = clCreateCommandQueue(_context, _device, 0 /* IN-ORDER */, &err);
-    CHECK("clCreateCommandQueue CPU");
+    _sub_devices.resize(count);
+    err = clCreateSubDevices(_device, props, count, _sub_devices.data(), NULL);
+    CHECK("clCreateSubDevices");
 
     return true;
 }
@@ -182,83 +353,36 @@ bool Fft::setup_cl() {
 bool Fft::setup_clFft() {
     cl_int err = 0;
 
-    // Setup clFFT. 
-    clfftSetupData fftSetup;
-    err = clfftInitSetupData(&fftSetup);
-    CHECK("clfftInitSetupData");
-    err = clfftSetup(&fftSetup);
-    CHECK("clfftSetup");
-    
-    return true;    
-}
+    if (_clfft_held)
+        return true;
 
-bool Fft::setup_forward() {
-    cl_int err = 0;
-    
-    // Size of FFT 
-    size_t clLengths = _fft_size;
-    clfftDim dim = CLFFT_1D;
+    // Setup clFFT, unless another instance already has
+    std::lock_guard<std::mutex> guard(_clfft_lock);
+    if (0 == _clfft_users) {
+        clfftSetupData fftSetup;
+        err = clfftInitSetupData(&fftSetup);
+        CHECK("clfftInitSetupData");
+        err = clfftSetup(&fftSetup);
+        CHECK("clfftSetup");
+    }
+    ++_clfft_users;
+    _clfft_held = true;
     
-    // Create a default plan for a complex FFT 
-    err = clfftCreateDefaultPlan(&_forward, _context, dim, &clLengths);
-    CHECK("clfftCreateDefaultPlan");
-
-    // Set plan parameters
-    err = clfftSetPlanPrecision(_forward, CLFFT_SINGLE);
-    CHECK("clfftSetPlanPrecision");
-    err = clfftSetLayout(_forward, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
-    CHECK("clfftSetLayout");
-    err = clfftSetResultLocation(_forward, CLFFT_INPLACE);
-    CHECK("clfftSetResultLocation");
-
-    // Bake the plan
-    err = clfftBakePlan(_forward, 1, &_queue, NULL, NULL);
-    CHECK("clfftBakePlan");
-
-    return true;
+    return true;    
 }
 
-bool Fft::setup_backward() {
-    cl_int err = 0;
-
-    // Size of FFT
-    size_t clLengths = _fft_size;
-    clfftDim dim = CLFFT_1D;
-    
-    // Create a default plan for a complex FFT 
-    err = clfftCreateDefaultPlan(&_backward, _context, dim, &clLengths);
-    CHECK("clfftCreateDefaultPlan");
-
-    // Set plan parameters
-    err = clfftSetPlanPrecision(_backward, CLFFT_SINGLE);
-    CHECK("clfftSetPlanPrecision");
-    err = clfftSetLayout(_backward, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
-    CHECK("clfftSetLayout");
-    err = clfftSetResultLocation(_backward, CLFFT_INPLACE);
-    CHECK("clfftSetResultLocation");
-
-    // Bake the plan
-    err = clfftBakePlan(_backward, 1, &_queue, NULL, NULL);
-    CHECK("clfftBakePlan");
-
-    return true;
-}
+// Lane for a job: its own if it has one, otherwise the next with a free slot
+FftQueue* Fft::select_queue(FftJob& job) {
 
+    if (0 <= job.lane() && job.lane() < (int) _queues.size())
+        return _queues[job.lane()];
 
-bool Fft::setup_buffers() {
-    for (int i = 0; i < _parallel; ++i) {
-        _buffers.push_back(new FftBuffer(*this));
+    for (size_t i = 0; i < _queues.size(); ++i) {
+        FftQueue* queue = _queues[_next_queue++ % _queues.size()];
+        if (queue->has_free_buffer())
+            return queue;
     }
-}
 
-FftBuffer* Fft::get_buffer() {
-    
-    for (auto buffer : _buffers) {
-        if (buffer->in_use())
-            continue;
-        buffer->set_in_use(true);
-        return buffer;
-    }
-    
-    return NULL;
-}
\ No newline at end of file
+    // all busy, the lane waits for its oldest slot
+    return _queues[_next_queue++ % _queues.size()];
+}
@@ -2,55 +2,152 @@
 #define __fft_h
 
 #include <clFFT.h>
+#include <string>
 #include <vector>
 
 #include "fftjob.hh"
 #include "fftbuffer.hh"
+#include "fftcache.hh"
+#include "fftkernel.hh"
+#include "fftqueue.hh"
+#include "fftmetrics.hh"
+#include "ffttrace.hh"
 
 class Fft {
 
 public:
     enum Device    {GPU, CPU};
+    enum Transfer  {FLOAT, HALF, INT16};
+    enum Fission   {NONE, NUMA, L3, EQUAL};
+    enum Policy    {PAD, BLUESTEIN};
     
 public:
     Fft(size_t fft_size, Device device, int parallel);
 
     bool    init();    
+    bool    init_cl();
     void    shutdown();
 
     size_t  get_size() { return _fft_size; }
+
+    // Lengths clFFT cannot run directly are either zero padded to the next
+    // fast length (spectrum of the padded length) or computed exactly with
+    // Bluestein's chirp-z algorithm on a fast convolution length. Before init().
+    void    set_policy(Policy policy);
+    Policy  get_policy() { return _policy; }
+    size_t  get_plan_size() { return _plan_size; }
+    bool    is_padded() { return PAD == _policy && _plan_size != _fft_size; }
+    bool    is_bluestein() { return BLUESTEIN == _policy && _plan_size != _fft_size; }
+
+    // Jobs of interleaved channels (see FftJob::set_layout), all run as one
+    // batched strided plan out of place; stride 0 means packed frames.
+    // Not with Bluestein. Before init().
+    void    set_channels(int channels, int stride = 0);
+    int     get_channels() { return _channels; }
+    int     get_stride() { return _stride; }
+    bool    is_strided() { return 1 < _stride; }
+
+    // Floats a job must hold, and that cross the bus for each direction
+    size_t  get_job_capacity();
+    size_t  get_input_count(clfftDirection direction);
+    size_t  get_output_count(clfftDirection direction);
+    size_t  get_spectra_count();
+
+    static bool     is_fast_size(size_t size);
+    static size_t   next_fast_size(size_t size);
+
+    // Must be called before init()
+    void    set_transfer(Transfer transfer, bool pack_output);
+    Transfer get_transfer() { return _transfer; }
+    bool    get_pack_output() { return _pack_output; }
+    bool    is_packed();
+
+    // Partition the device into sub-devices, one lane each. Must be called
+    // before init(); units is the compute units per partition for EQUAL.
+    void    set_fission(Fission fission, int units = 0);
+    int     get_partitions() { return _queues.size(); }
+
+    // Device bytes all lanes together may use, 0 for no limit, clamped to
+    // the device's global memory. Slots are
+    // then capped at what fits beside the shared scratch; jobs beyond the
+    // slots wait for the oldest transform in their lane. Before init().
+    void    set_mem_budget(size_t bytes) { _mem_budget = bytes; }
+    size_t  get_mem_budget() { return _mem_budget; }
+    int     get_slots();
+    size_t  get_slot_bytes();
+    size_t  get_shared_bytes();
+    size_t  get_device_memory();
+
+    // Compiled kernel cache directory, empty to disable. Before init().
+    void    set_cache(const std::string& dir);
+    FftCache* get_cache() { return _cache; }
+
+    // Record host and device spans of every transform, NULL to disable.
+    // Not owned; before init(), as it turns on queue profiling.
+    void    set_trace(FftTrace* trace) { _trace = trace; }
+    FftTrace* get_trace() { return _trace; }
+
+    // Count jobs, bytes, slot use and stage latencies, NULL to disable.
+    // Not owned, may be shared by several Ffts; before init().
+    void    set_metrics(FftMetrics* metrics) { _metrics = metrics; }
+    FftMetrics* get_metrics() { return _metrics; }
+
+    // Wall time of init() and whether it was served from the caches
+    double  get_startup_time() { return _startup_ms; }
+    bool    is_warm_start();
     
+    // Transforms are enqueued when a lane's slots are all submitted, on
+    // flush() or on wait_all(), so adjacent slots can share transfers
     bool    forward(FftJob& job);
     bool    backward(FftJob& job);
+    bool    flush();
     void    wait_all();
 
+    FftJob* create_job(double mean, double std);
+
 public:
-    cl_context  get_context() { return _context; }
-    size_t      get_temp_buffer_size();
+    // The first lane, for users that drive the device directly
+    cl_context          get_context()   { return _queues.at(0)->get_context(); }
+    cl_device_id        get_device()    { return _queues.at(0)->get_device(); }
+    cl_command_queue    get_queue()     { return _queues.at(0)->get_queue(); }
+    size_t              get_temp_buffer_size();
 
 private:
     bool select_platform();
-    bool setup_cl();
+    bool setup_devices();
     bool setup_clFft();
-    bool setup_forward();
-    bool setup_backward();
-    bool setup_buffers();
 
-    FftBuffer*  get_buffer();
+    bool transform(FftJob& job, clfftDirection direction);
+    FftQueue*   select_queue(FftJob& job);
 
 private:
     size_t                  _fft_size;
     Device                  _device_type;
     int                     _parallel;
+    Policy                  _policy;
+    size_t                  _plan_size;
+    int                     _channels;
+    int                     _stride;
+    Transfer                _transfer;
+    bool                    _pack_output;
+    Fission                 _fission;
+    int                     _fission_units;
+    size_t                  _mem_budget;
 
     cl_platform_id          _platform;
     cl_device_id            _device;
-    cl_context              _context;
-    cl_command_queue        _queue;
-    clfftPlanHandle         _forward;
-    clfftPlanHandle         _backward;
+    std::vector<cl_device_id> _sub_devices;
     
-    std::vector<FftBuffer*> _buffers;
+    std::vector<FftQueue*>  _queues;
+    size_t                  _next_queue;
+    size_t                  _next_job;
+
+    FftCache*               _cache;
+    FftTrace*               _trace;
+    FftMetrics*             _metrics;
+    double                  _startup_ms;
+    int                     _clfft_entries;
+    bool                    _clfft_held;        // counted in the clFFT users
 };
 
 #endif // __fft_h
@@ -1,7 +1,9 @@
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 
 #include "fft.hh"
+#include "fftpack.hh"
 
 #define CHECK(MSG)                              \
     if (err != CL_SUCCESS) {                    \
@@ -11,25 +13,40 @@
       return;                                   \
     }
 
-FftBuffer::FftBuffer(Fft& fft)
-  : _fft(fft),
+FftBuffer::FftBuffer(FftQueue& queue, int index)
+  : _queue(queue),
+    _index(index),
     _job(NULL),
-    _temp_buf(0),
+    _output_buf(0),
+    _packed_buf(0),
+    _unpack_count(0),
+    _unpack_scale(0),
+    _chirp_buf(0),
+    _staged(0),
+    _direction(CLFFT_FORWARD),
     _wait{0},
+    _sequence(0),
+    _submitted(0),
     _in_use(false)
 {
-    cl_int err = 0;
+    memset(_stages, 0, sizeof(_stages));
 
-    // allocate device local memory
-    _data_buf = clCreateBuffer(fft.get_context(), CL_MEM_READ_WRITE, size(), NULL, &err);
-    CHECK("clCreateBuffer data");
+    // device memory is carved from the lane's slab
+    _data_buf = queue.sub_buffer(FftQueue::DATA, index);
 
-    // allocate temp buffer
-    size_t temp_size = fft.get_temp_buffer_size();
-    if (0 != temp_size) {
-        _temp_buf = clCreateBuffer(fft.get_context(), CL_MEM_READ_WRITE, temp_size, 0, &err);
-        CHECK("clCreateBuffer temp");
+    // out of place result of interleaved channels
+    if (queue.get_fft().is_strided())
+        _output_buf = queue.sub_buffer(FftQueue::SPECTRUM, index);
+
+    // packed transfer buffers
+    if (queue.get_fft().is_packed()) {
+        _packed.resize(queue.get_fft().get_job_capacity());
+        _packed_buf = queue.sub_buffer(FftQueue::PACKED, index);
     }
+
+    // the chirp-z workspace
+    if (queue.get_fft().is_bluestein())
+        _chirp_buf = queue.sub_buffer(FftQueue::CHIRP, index);
 }
 
 FftBuffer::~FftBuffer() {
@@ -42,16 +59,83 @@ void FftBuffer::release() {
         clReleaseMemObject(_data_buf);
         _data_buf = NULL;
     }
-    if (NULL != _temp_buf) {
-        clReleaseMemObject(_temp_buf);
-        _temp_buf = NULL;
+    if (NULL != _output_buf) {
+        clReleaseMemObject(_output_buf);
+        _output_buf = NULL;
+    }
+    if (NULL != _packed_buf) {
+        clReleaseMemObject(_packed_buf);
+        _packed_buf = NULL;
+    }
+    if (NULL != _chirp_buf) {
+        clReleaseMemObject(_chirp_buf);
+        _chirp_buf = NULL;
     }
 }
 
 void FftBuffer::wait() {
+    FftTrace::Span span(_queue.get_fft().get_trace(), "wait");
+
     cl_int err = clWaitForEvents(1, &_wait);
     CHECK("clWaitForEvents");
+    clReleaseEvent(_wait);
+    _wait = 0;
+    flush_trace();
+
+    // widen a packed result into the job, or copy it out of the staging slab
+    if (0 != _unpack_scale)
+        unpack_half(_packed.data(), job_data(), _unpack_count, _unpack_scale);
+    else if (0 != _staged)
+        memcpy(job_data(), _queue.staging(_index), _staged * sizeof(cl_float));
     _in_use = false;
+
+    FftMetrics* metrics = _queue.get_fft().get_metrics();
+    if (NULL != metrics) {
+        metrics->add(FftMetrics::COMPLETED);
+        metrics->add(FftMetrics::SLOTS_BUSY, -1);
+        metrics->observe(FftMetrics::JOB, FftMetrics::now() - _submitted);
+    }
+}
+
+// Keep a stage's events until the slot completes, when tracing or timing
+void FftBuffer::trace(Stage stage, cl_event first, cl_event last) {
+    Fft& fft = _queue.get_fft();
+    if (NULL == fft.get_trace() && NULL == fft.get_metrics())
+        return;
+    clRetainEvent(first);
+    clRetainEvent(last);
+    _stages[stage][0] = first;
+    _stages[stage][1] = last;
+}
+
+// the queue is in order, so every stage is done once the read is
+void FftBuffer::flush_trace() {
+    static const char* names[STAGES] = {"write", "transform", "read"};
+    static const FftMetrics::Stage timed[STAGES] = {FftMetrics::WRITE, FftMetrics::TRANSFORM, 
+                                                    FftMetrics::READ};
+    FftTrace*   trace   = _queue.get_fft().get_trace();
+    FftMetrics* metrics = _queue.get_fft().get_metrics();
+
+    for (int stage = 0; stage < STAGES; ++stage) {
+        cl_event* events = _stages[stage];
+        if (0 == events[0])
+            continue;
+        if (NULL != trace)
+            trace->device(names[stage], _queue.get_index(), _index, events[0], events[1],
+                          _queue.get_trace_offset());
+        if (NULL != metrics) {
+            cl_ulong start = 0;
+            cl_ulong end   = 0;
+            if (CL_SUCCESS == clGetEventProfilingInfo(events[0], CL_PROFILING_COMMAND_START,
+                                                      sizeof(start), &start, NULL) &&
+                CL_SUCCESS == clGetEventProfilingInfo(events[1], CL_PROFILING_COMMAND_END,
+                                                      sizeof(end), &end, NULL))
+                metrics->observe(timed[stage], (int64_t) (end - start));
+        }
+        clReleaseEvent(events[0]);
+        clReleaseEvent(events[1]);
+        events[0] = events[1] = 0;
+    }
 }
 
 void dump_status(cl_int status) {
@@ -73,10 +157,29 @@ bool FftBuffer::is_finished() {
     return CL_COMPLETE == real_info;
 }
 
-inline size_t FftBuffer::get_fft_size() { 
-    return _fft.get_size();
+size_t FftBuffer::get_fft_size() { 
+    return _queue.get_fft().get_size();
+}
+
+// room for the plan input and the hermitian result
+size_t FftBuffer::data_size(Fft& fft) {
+    size_t length = fft.is_bluestein() ? fft.get_size() : fft.get_plan_size();
+    return std::max(fft.get_job_capacity(), length) * sizeof(cl_float);
+}
+
+size_t FftBuffer::chirp_size(Fft& fft) {
+    return fft.is_bluestein() ? fft.get_plan_size() * 2 * sizeof(cl_float) : 0;
+}
+
+size_t FftBuffer::packed_size(Fft& fft) {
+    return fft.is_packed() ? fft.get_job_capacity() * sizeof(cl_half) : 0;
+}
+
+// one transform runs at a time on the lane's in-order queue
+cl_mem FftBuffer::temp() {
+    return _queue.get_temp();
 }
 
-inline size_t FftBuffer::size() {
-    return _fft.get_size() * sizeof(cl_float);
+cl_float* FftBuffer::job_data() {
+    return _job->data();
 }
\ No newline at end of file
@@ -2,15 +2,22 @@
 #define __FftBuffer_hh
 
 #include <clFFT.h>
+#include <cstdint>
+#include <vector>
 
 class Fft;
+class FftJob;
+class FftQueue;
 
 class FftBuffer {
 
-friend class Fft;
+friend class FftQueue;
 
 public:
-    FftBuffer(Fft& fft);
+    enum Stage {WRITE, TRANSFORM, READ, STAGES};
+
+public:
+    FftBuffer(FftQueue& queue, int index);
     ~FftBuffer();
 
     void        set_job(FftJob* job)        { _job = job; }
@@ -22,30 +29,64 @@ public:
     void        release();
 
     size_t      get_fft_size();
+    int         get_index()                 { return _index; }
+
+    // device bytes of each of a slot's regions
+    static size_t data_size(Fft& fft);
+    static size_t packed_size(Fft& fft);
+    static size_t chirp_size(Fft& fft);
 
     bool        in_use()                    { return _in_use; }
     void        set_in_use(bool in_use)     { _in_use = in_use; }
 
 private:
-    size_t      size();
-
-private:
-    cl_float*   job_data()                  { return _job->data(); }
+    cl_float*   job_data();
 
     cl_mem      data()                      { return _data_buf; }
     cl_mem*     data_addr()                 { return &_data_buf; }
-    cl_mem      temp()                      { return _temp_buf; }
+    cl_mem      output()                    { return _output_buf ? _output_buf : _data_buf; }
+    cl_mem*     output_addr()               { return _output_buf ? &_output_buf : NULL; }
+    cl_mem      temp();
+
+    cl_half*    packed()                    { return _packed.data(); }
+    cl_mem      packed_data()               { return _packed_buf; }
+    void        set_unpack(size_t count, float scale) { _unpack_count = count; _unpack_scale = scale; }
+    void        set_staged(size_t count)    { _staged = count; }
+
+    cl_mem      chirp()                     { return _chirp_buf; }
 
     void        set_wait(cl_event wait)     { _wait = wait; }
+    void        trace(Stage stage, cl_event first, cl_event last);
+    void        flush_trace();
 
 private:
-    Fft&        _fft;
+    FftQueue&   _queue;
+    int         _index;
     FftJob*     _job;
     
     cl_mem      _data_buf;
-    cl_mem      _temp_buf;
+    cl_mem      _output_buf;
+
+    // compressed transfer staging, see Fft::set_transfer()
+    cl_mem                  _packed_buf;
+    std::vector<cl_half>    _packed;
+    size_t                  _unpack_count;
+    float                   _unpack_scale;
+
+    // Bluestein convolution workspace
+    cl_mem                  _chirp_buf;
+
+    // result floats to copy from the host slab, after a merged read
+    size_t                  _staged;
+
+    clfftDirection          _direction;
     
     cl_event    _wait;
+    uint64_t    _sequence;
+    int64_t     _submitted;         // FftMetrics::now() when claimed
+
+    // first and last command of each stage while tracing or timing
+    cl_event    _stages[STAGES][2];
     
     bool        _in_use;
 };
@@ -0,0 +1,208 @@
+#include <iostream>
+#include <fstream>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fftcache.hh"
+
+static const char* _cache_magic = "clfft-test-cache 1";
+
+static uint64_t fnv1a(const std::string& text) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static std::string hex(uint64_t value) {
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", (unsigned long long) value);
+    return text;
+}
+
+static std::string device_string(cl_device_id device, cl_device_info info) {
+    size_t size = 0;
+    if (CL_SUCCESS != clGetDeviceInfo(device, info, 0, NULL, &size) || 0 == size)
+        return "";
+    std::vector<char> text(size);
+    clGetDeviceInfo(device, info, size, text.data(), NULL);
+    return text.data();
+}
+
+static std::string platform_version(cl_device_id device) {
+    cl_platform_id platform = NULL;
+    clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL);
+
+    size_t size = 0;
+    if (CL_SUCCESS != clGetPlatformInfo(platform, CL_PLATFORM_VERSION, 0, NULL, &size) || 0 == size)
+        return "";
+    std::vector<char> text(size);
+    clGetPlatformInfo(platform, CL_PLATFORM_VERSION, size, text.data(), NULL);
+    return text.data();
+}
+
+static bool make_dirs(const std::string& dir) {
+    for (size_t pos = 0; pos != std::string::npos; ) {
+        pos = dir.find('/', pos + 1);
+        std::string part = dir.substr(0, pos);
+        if (0 != mkdir(part.c_str(), 0755) && EEXIST != errno)
+            return false;
+    }
+    return true;
+}
+
+FftCache::FftCache(const std::string& dir)
+  : _dir(dir),
+    _hits(0),
+    _misses(0)
+{
+    if (!_dir.empty() && !make_dirs(_dir)) {
+        std::cerr << "Kernel cache disabled, unable to create " << _dir << std::endl;
+        _dir.clear();
+    }
+}
+
+std::string FftCache::default_dir() {
+    const char* xdg  = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+
+    if (NULL != xdg && 0 != *xdg)
+        return std::string(xdg) + "/clfft-test";
+    if (NULL != home && 0 != *home)
+        return std::string(home) + "/.cache/clfft-test";
+    return "";
+}
+
+std::string FftCache::key(cl_device_id device, const char* source, const std::string& options) {
+    std::ostringstream key;
+    key << platform_version(device) << "|"
+        << device_string(device, CL_DEVICE_VENDOR) << "|"
+        << device_string(device, CL_DEVICE_NAME) << "|"
+        << device_string(device, CL_DEVICE_VERSION) << "|"
+        << device_string(device, CL_DRIVER_VERSION) << "|"
+        << options << "|"
+        << hex(fnv1a(source));
+    return key.str();
+}
+
+std::string FftCache::path(const std::string& key) {
+    return _dir + "/" + hex(fnv1a(key)) + ".bin";
+}
+
+cl_program FftCache::load(cl_context context, cl_device_id device, 
+                          const std::string& key, const std::string& options) {
+    if (!enabled())
+        return NULL;
+
+    std::ifstream ifs(path(key), std::ios::binary);
+    std::string magic;
+    std::string stored;
+    uint64_t    size = 0;
+
+    if (!std::getline(ifs, magic) || !std::getline(ifs, stored) ||
+        _cache_magic != magic || key != stored ||
+        !ifs.read((char*) &size, sizeof(size)) || 0 == size) {
+        ++_misses;
+        return NULL;
+    }
+
+    std::vector<unsigned char> binary(size);
+    if (!ifs.read((char*) binary.data(), size)) {
+        ++_misses;
+        return NULL;
+    }
+
+    // a binary from another driver build is rejected here or at build time
+    cl_int err = 0;
+    cl_int status = 0;
+    size_t length = binary.size();
+    const unsigned char* data = binary.data();
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, &length, &data, 
+                                                   &status, &err);
+    if (CL_SUCCESS == err && CL_SUCCESS == status)
+        err = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+
+    if (CL_SUCCESS != err || CL_SUCCESS != status) {
+        if (NULL != program)
+            clReleaseProgram(program);
+        ++_misses;
+        return NULL;
+    }
+
+    ++_hits;
+    return program;
+}
+
+void FftCache::store(cl_program program, const std::string& key) {
+    if (!enabled())
+        return;
+
+    size_t size = 0;
+    if (CL_SUCCESS != clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) ||
+        0 == size)
+        return;
+
+    std::vector<unsigned char> binary(size);
+    unsigned char* data = binary.data();
+    if (CL_SUCCESS != clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, NULL))
+        return;
+
+    // write aside and rename, concurrent runs never see a partial entry;
+    // a failed store leaves nothing behind
+    std::string final = path(key);
+    std::string temp  = final + "." + std::to_string(getpid());
+
+    std::ofstream ofs(temp, std::ios::binary);
+    uint64_t length = size;
+    ofs << _cache_magic << "\n" << key << "\n";
+    ofs.write((const char*) &length, sizeof(length));
+    ofs.write((const char*) data, size);
+    ofs.close();
+
+    if (!ofs || 0 != rename(temp.c_str(), final.c_str()))
+        unlink(temp.c_str());
+}
+
+void FftCache::use_for_clfft() {
+    if (!enabled())
+        return;
+
+    // a path the user exported wins, but say so, and count what clFFT uses
+    std::string dir = _dir + "/clfft";
+    const char* current = getenv("CLFFT_CACHE_PATH");
+    if (NULL != current && '\0' != current[0]) {
+        if (dir != current)
+            std::cerr << "clFFT kernels cached in " << current 
+                      << " from CLFFT_CACHE_PATH, not " << dir << std::endl;
+        _clfft_dir = current;
+    } else if (make_dirs(dir) && 0 == setenv("CLFFT_CACHE_PATH", dir.c_str(), 1)) {
+        _clfft_dir = dir;
+    }
+}
+
+int FftCache::count_clfft_entries() {
+    if (_clfft_dir.empty())
+        return 0;
+
+    DIR* handle = opendir(_clfft_dir.c_str());
+    if (NULL == handle)
+        return 0;
+
+    int count = 0;
+    while (dirent* entry = readdir(handle)) {
+        if ('.' != entry->d_name[0])
+            ++count;
+    }
+    closedir(handle);
+    return count;
+}
@@ -0,0 +1,48 @@
+#ifndef __FftCache_hh
+#define __FftCache_hh
+
+#include <clFFT.h>
+#include <string>
+
+// On-disk cache of compiled OpenCL program binaries.
+//
+// Entries are keyed by platform, device, driver version, build options and
+// a hash of the source; the full key is stored in the entry and checked on
+// load, and a binary the driver rejects falls back to a source build that
+// replaces it. clFFT's own plan kernels are cached by clFFT itself in the
+// "clfft" sub-directory (CLFFT_CACHE_PATH), unless the environment already
+// names another directory.
+
+class FftCache {
+
+public:
+    FftCache(const std::string& dir);
+
+    bool        enabled()                   { return !_dir.empty(); }
+    const std::string& get_dir()            { return _dir; }
+
+    std::string key(cl_device_id device, const char* source, const std::string& options);
+
+    cl_program  load(cl_context context, cl_device_id device, 
+                     const std::string& key, const std::string& options);
+    void        store(cl_program program, const std::string& key);
+
+    void        use_for_clfft();
+
+    int         get_hits()                  { return _hits; }
+    int         get_misses()                { return _misses; }
+    int         count_clfft_entries();
+
+    static std::string default_dir();
+
+private:
+    std::string path(const std::string& key);
+
+private:
+    std::string _dir;
+    std::string _clfft_dir;
+    int         _hits;
+    int         _misses;
+};
+
+#endif // __FftCache_hh
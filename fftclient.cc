@@ -0,0 +1,207 @@
+#include <iostream>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "fftclient.hh"
+
+static std::atomic<int> _region_count(0);
+
+FftClient::FftClient(const std::string& path)
+  : _path(path),
+    _fd(-1),
+    _region(NULL),
+    _region_bytes(0),
+    _slots(0),
+    _slot_size(0)
+{
+}
+
+FftClient::~FftClient() {
+    close();
+}
+
+bool FftClient::connect(size_t slots, size_t slot_size) {
+    return open() && attach(slots, slot_size);
+}
+
+bool FftClient::open() {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, _path.c_str(), sizeof(addr.sun_path) - 1);
+
+    _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_fd < 0 || 0 != ::connect(_fd, (sockaddr*) &addr, sizeof(addr))) {
+        std::cerr << "Unable to connect to " << _path << ": " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+// slot floats the server needs for fft_size, 0 if it cannot transform it
+size_t FftClient::capacity(size_t fft_size) {
+    FftRequest request;
+    memset(&request, 0, sizeof(request));
+    request.op   = FftRequest::CAPACITY;
+    request.size = fft_size;
+
+    FftResponse response;
+    if (!send_request(request) || !complete(response) || FftResponse::OK != response.status)
+        return 0;
+    return response.capacity;
+}
+
+bool FftClient::attach(size_t slots, size_t slot_size) {
+
+    // create the slot array, sealed at its size so the server's mapping stays valid
+    _name = "clfft-" + std::to_string(getpid()) + "-" + std::to_string(_region_count++);
+    _region_bytes = fft_slots_bytes(slots, slot_size);
+
+    int shm = memfd_create(_name.c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (shm < 0 || 0 != ftruncate(shm, _region_bytes) ||
+        0 != fcntl(shm, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+        std::cerr << "Unable to create " << _name << ": " << strerror(errno) << std::endl;
+        if (0 <= shm)
+            ::close(shm);
+        close();
+        return false;
+    }
+
+    _region = mmap(NULL, _region_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    if (MAP_FAILED == _region) {
+        _region = NULL;
+        ::close(shm);
+        close();
+        return false;
+    }
+
+    FftSlotArray* header   = (FftSlotArray*) _region;
+    header->magic     = FFT_SERVICE_MAGIC;
+    header->slots     = slots;
+    header->slot_size = slot_size;
+    _slots     = slots;
+    _slot_size = slot_size;
+
+    FftRequest request;
+    memset(&request, 0, sizeof(request));
+    request.op = FftRequest::ATTACH;
+    strncpy(request.name, _name.c_str(), FFT_SERVICE_NAME - 1);
+
+    // the memfd goes along with the request, then only the mapping is kept
+    FftResponse response;
+    bool sent = send_request(request, shm);
+    ::close(shm);
+    if (!sent || !complete(response) || FftResponse::OK != response.status) {
+        std::cerr << "Server refused slot array " << _name << std::endl;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void FftClient::close() {
+
+    if (0 <= _fd) {
+        ::close(_fd);
+        _fd = -1;
+    }
+    if (NULL != _region) {
+        munmap(_region, _region_bytes);
+        _region = NULL;
+    }
+    _name.clear();
+}
+
+bool FftClient::submit(size_t slot, size_t fft_size, bool forward, uint64_t tag) {
+    FftRequest request;
+    memset(&request, 0, sizeof(request));
+    request.op   = forward ? FftRequest::FORWARD : FftRequest::BACKWARD;
+    request.slot = slot;
+    request.size = fft_size;
+    request.tag  = tag;
+
+    return send_request(request);
+}
+
+bool FftClient::complete(FftResponse& response) {
+    char*  data = (char*) &response;
+    size_t left = sizeof(response);
+
+    while (0 < left) {
+        ssize_t count = recv(_fd, data, left, 0);
+        if (count < 0 && EINTR == errno)
+            continue;
+        if (count <= 0)
+            return false;
+        data += count;
+        left -= count;
+    }
+
+    return true;
+}
+
+bool FftClient::forward(size_t slot, size_t fft_size) {
+    FftResponse response;
+    return submit(slot, fft_size, true) && complete(response) && 
+           FftResponse::OK == response.status;
+}
+
+bool FftClient::backward(size_t slot, size_t fft_size) {
+    FftResponse response;
+    return submit(slot, fft_size, false) && complete(response) && 
+           FftResponse::OK == response.status;
+}
+
+bool FftClient::send_request(const FftRequest& request, int fd) {
+    const char* data = (const char*) &request;
+    size_t      left = sizeof(request);
+
+    // the descriptor travels with the first byte
+    if (0 <= fd) {
+        char   control[CMSG_SPACE(sizeof(int))];
+        iovec  io = {(void*) data, left};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        memset(control, 0, sizeof(control));
+        msg.msg_iov        = &io;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        cmsghdr* cmsg    = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_RIGHTS;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+        ssize_t count;
+        do {
+            count = sendmsg(_fd, &msg, MSG_NOSIGNAL);
+        } while (count < 0 && EINTR == errno);
+        if (count <= 0)
+            return false;
+        data += count;
+        left -= count;
+    }
+
+    while (0 < left) {
+        ssize_t count = send(_fd, data, left, MSG_NOSIGNAL);
+        if (count < 0 && EINTR == errno)
+            continue;
+        if (count <= 0)
+            return false;
+        data += count;
+        left -= count;
+    }
+
+    return true;
+}
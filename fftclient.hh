@@ -0,0 +1,51 @@
+#ifndef __FftClient_hh
+#define __FftClient_hh
+
+#include <string>
+
+#include "fftservice.hh"
+
+// Client side of the FFT service. Owns a shared-memory array of sample slots;
+// fill a slot, submit() it and collect the in-place result with complete().
+// Any number of slots may be in flight at once. A slot needs room for the
+// result, 2 * (N / 2 + 1) floats for an N point transform of a fast size
+// and more for a padded one; capacity() asks the server, after open() and
+// before attach(). connect() is open() and attach() together.
+
+class FftClient {
+
+public:
+    FftClient(const std::string& path);
+    ~FftClient();
+
+    bool        connect(size_t slots, size_t slot_size);
+    bool        open();
+    size_t      capacity(size_t fft_size);
+    bool        attach(size_t slots, size_t slot_size);
+    void        close();
+
+    float*      slot(size_t index)          { return fft_slot(_region, index); }
+    size_t      get_slots()                 { return _slots; }
+    size_t      get_slot_size()             { return _slot_size; }
+
+    bool        submit(size_t slot, size_t fft_size, bool forward, uint64_t tag = 0);
+    bool        complete(FftResponse& response);
+
+    bool        forward(size_t slot, size_t fft_size);
+    bool        backward(size_t slot, size_t fft_size);
+
+private:
+    bool        send_request(const FftRequest& request, int fd = -1);
+
+private:
+    std::string _path;
+    std::string _name;
+
+    int         _fd;
+    void*       _region;
+    size_t      _region_bytes;
+    size_t      _slots;
+    size_t      _slot_size;
+};
+
+#endif // __FftClient_hh
@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <iostream>
+
+#include "fft.hh"
+#include "fftgraph.hh"
+
+#define CHECK(MSG)                              \
+    if (err != CL_SUCCESS) {                    \
+      std::cerr << __FILE__ << ":" << __LINE__  \
+          << " Unexpected result for " << MSG   \
+          << " (" << err << ")" << std::endl;   \
+      return false;                             \
+    }
+
+// One work group strides over the input and folds in local memory
+static const char* _reduce_source =
+"__kernel void sum_squares(__global const float* a, __global const float* b, \n"
+"                          __global float* out, uint count, int subtract)    \n"
+"{                                                                           \n"
+"    __local float part[256];                                                \n"
+"    size_t l = get_local_id(0);                                             \n"
+"    size_t n = get_local_size(0);                                           \n"
+"    float  sum = 0;                                                         \n"
+"    for (size_t i = l; i < count; i += n) {                                 \n"
+"        float v = subtract ? a[i] - b[i] : a[i];                            \n"
+"        sum += v * v;                                                       \n"
+"    }                                                                       \n"
+"    part[l] = sum;                                                          \n"
+"    barrier(CLK_LOCAL_MEM_FENCE);                                           \n"
+"    for (size_t s = n / 2; s > 0; s >>= 1) {                                \n"
+"        if (l < s)                                                          \n"
+"            part[l] += part[l + s];                                         \n"
+"        barrier(CLK_LOCAL_MEM_FENCE);                                       \n"
+"    }                                                                       \n"
+"    if (0 == l)                                                             \n"
+"        out[0] = part[0];                                                   \n"
+"}                                                                           \n";
+
+static const size_t _reduce_width = 256;
+
+FftGraph::FftGraph(Fft& fft)
+  : _fft(fft),
+    _size(fft.get_size()),
+    _queue(NULL),
+    _transform_queue(NULL),
+    _concurrent(false),
+    _valid(true),
+    _compiled(false),
+    _forward(0),
+    _backward(0),
+    _reduce(fft.get_context(), fft.get_device(), _reduce_source, "sum_squares")
+{
+}
+
+FftGraph::~FftGraph() {
+    release();
+}
+
+FftGraph::Node FftGraph::add(Kind kind, const std::vector<Node>& inputs, size_t count) {
+
+    for (auto input : inputs) {
+        if (input < 0 || input >= (Node) _stages.size() || DOWNLOAD == _stages[input].kind) {
+            std::cerr << "Error: graph stage " << _stages.size() << " reads no value" << std::endl;
+            _valid = false;
+        }
+    }
+    if (_compiled) {
+        std::cerr << "Error: graph already compiled" << std::endl;
+        _valid = false;
+    }
+
+    Stage stage;
+    stage.kind     = kind;
+    stage.inputs   = inputs;
+    stage.count    = count;
+    stage.source   = NULL;
+    stage.target   = NULL;
+    stage.kernel   = NULL;
+    stage.buffer   = -1;
+    stage.last_use = -1;
+    stage.done     = 0;
+
+    _stages.push_back(stage);
+    return _stages.size() - 1;
+}
+
+FftGraph::Node FftGraph::upload(const cl_float* host, size_t count) {
+    Node node = add(UPLOAD, {}, count);
+    _stages[node].source = host;
+    return node;
+}
+
+FftGraph::Node FftGraph::forward(Node input) {
+    Node node = add(FORWARD, {input}, 2 * (_size / 2 + 1));
+    if (_valid && _size != _stages[input].count) {
+        std::cerr << "Error: forward transform of " << _stages[input].count
+                  << " floats, expected " << _size << std::endl;
+        _valid = false;
+    }
+    return node;
+}
+
+FftGraph::Node FftGraph::backward(Node input) {
+    Node node = add(BACKWARD, {input}, _size);
+    if (_valid && 2 * (_size / 2 + 1) != _stages[input].count) {
+        std::cerr << "Error: backward transform of " << _stages[input].count
+                  << " floats, expected " << 2 * (_size / 2 + 1) << std::endl;
+        _valid = false;
+    }
+    return node;
+}
+
+FftGraph::Node FftGraph::kernel(const char* source, const char* name,
+                                const std::vector<Node>& inputs, size_t count,
+                                const std::string& options) {
+    Node node = add(KERNEL, inputs, count);
+    _stages[node].kernel  = new FftKernel(_fft.get_context(), _fft.get_device(), source, name);
+    _stages[node].options = options;
+    return node;
+}
+
+FftGraph::Node FftGraph::sum_squares(Node input, Node minus) {
+    if (minus < 0)
+        return add(REDUCE, {input}, 1);
+
+    Node node = add(REDUCE, {input, minus}, 1);
+    if (_valid && _stages[input].count != _stages[minus].count) {
+        std::cerr << "Error: difference of " << _stages[input].count << " and "
+                  << _stages[minus].count << " floats" << std::endl;
+        _valid = false;
+    }
+    return node;
+}
+
+void FftGraph::download(Node input, cl_float* host) {
+    Node node = add(DOWNLOAD, {input}, 0);
+    _stages[node].target = host;
+}
+
+bool FftGraph::compile() {
+    bool reduce = false;
+    bool plans  = false;
+
+    if (!_valid)
+        return false;
+
+    for (auto& stage : _stages) {
+        reduce |= REDUCE == stage.kind;
+        plans  |= FORWARD == stage.kind || BACKWARD == stage.kind;
+        if (KERNEL == stage.kind && !stage.kernel->build(stage.options, _fft.get_cache()))
+            return false;
+    }
+
+    if (plans && !Fft::is_fast_size(_size)) {
+        std::cerr << "Error: graph transforms need a length clFFT can plan" << std::endl;
+        return false;
+    }
+
+    if (!setup_queue())
+        return false;
+    if (reduce && !_reduce.build("", _fft.get_cache()))
+        return false;
+    if (plans && (!setup_plan(&_forward, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED) ||
+                  !setup_plan(&_backward, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL)))
+        return false;
+    if (!assign_buffers())
+        return false;
+
+    _compiled = true;
+    return true;
+}
+
+bool FftGraph::setup_queue() {
+    cl_int err = 0;
+    cl_command_queue_properties supported = 0;
+
+    err = clGetDeviceInfo(_fft.get_device(), CL_DEVICE_QUEUE_PROPERTIES, sizeof(supported),
+                          &supported, NULL);
+    CHECK("clGetDeviceInfo CL_DEVICE_QUEUE_PROPERTIES");
+    _concurrent = 0 != (supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+
+    _queue = clCreateCommandQueue(_fft.get_context(), _fft.get_device(),
+                                  supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err);
+    CHECK("clCreateCommandQueue");
+    _transform_queue = clCreateCommandQueue(_fft.get_context(), _fft.get_device(), 0, &err);
+    CHECK("clCreateCommandQueue transforms");
+
+    return true;
+}
+
+bool FftGraph::setup_plan(clfftPlanHandle* plan, clfftLayout in, clfftLayout out) {
+    cl_int err = 0;
+
+    err = clfftCreateDefaultPlan(plan, _fft.get_context(), CLFFT_1D, &_size);
+    CHECK("clfftCreateDefaultPlan");
+
+    err = clfftSetPlanPrecision(*plan, CLFFT_SINGLE);
+    CHECK("clfftSetPlanPrecision");
+    err = clfftSetLayout(*plan, in, out);
+    CHECK("clfftSetLayout");
+    err = clfftSetResultLocation(*plan, CLFFT_OUTOFPLACE);
+    CHECK("clfftSetResultLocation");
+
+    err = clfftBakePlan(*plan, 1, &_transform_queue, NULL, NULL);
+    CHECK("clfftBakePlan");
+    if (NULL != _fft.get_metrics())
+        _fft.get_metrics()->add(FftMetrics::PLAN_BAKES);
+
+    return true;
+}
+
+// Walk the schedule: a value takes the smallest free buffer that holds it,
+// and gives it back after the stage that reads it last
+bool FftGraph::assign_buffers() {
+    cl_int err = 0;
+    std::vector<int> free;
+
+    for (size_t i = 0; i < _stages.size(); ++i) {
+        _stages[i].last_use = i;
+        for (auto input : _stages[i].inputs)
+            _stages[input].last_use = std::max(_stages[input].last_use, (int) i);
+    }
+
+    for (size_t i = 0; i < _stages.size(); ++i) {
+        Stage& stage = _stages[i];
+
+        if (DOWNLOAD != stage.kind) {
+            size_t bytes = stage.count * sizeof(cl_float);
+            auto   best  = free.end();
+            for (auto it = free.begin(); it != free.end(); ++it) {
+                if (_buffers[*it].bytes >= bytes &&
+                    (free.end() == best || _buffers[*it].bytes < _buffers[*best].bytes))
+                    best = it;
+            }
+
+            if (free.end() != best) {
+                stage.buffer = *best;
+                free.erase(best);
+            } else {
+                Buffer buffer;
+                buffer.bytes = bytes;
+                buffer.mem   = clCreateBuffer(_fft.get_context(), CL_MEM_READ_WRITE, bytes, NULL, &err);
+                CHECK("clCreateBuffer graph");
+                stage.buffer = _buffers.size();
+                _buffers.push_back(buffer);
+            }
+        }
+
+        // values nobody reads after this stage, including its own if unread
+        std::vector<Node> ending = stage.inputs;
+        ending.push_back(i);
+        for (auto node : ending) {
+            int buffer = _stages[node].buffer;
+            if (0 <= buffer && (int) i == _stages[node].last_use &&
+                free.end() == std::find(free.begin(), free.end(), buffer))
+                free.push_back(buffer);
+        }
+    }
+
+    return true;
+}
+
+// Every stage waits for its inputs, and for the users of the value its
+// buffer held before
+bool FftGraph::submit() {
+
+    if (!_compiled && !compile())
+        return false;
+
+    // buffer users keep any run still in flight ordered before this one
+    for (auto& stage : _stages) {
+        if (0 != stage.done)
+            clReleaseEvent(stage.done);
+        stage.done = 0;
+    }
+
+    for (auto& stage : _stages) {
+        std::vector<cl_event> wait;
+        for (auto input : stage.inputs)
+            wait.push_back(_stages[input].done);
+        if (0 <= stage.buffer) {
+            auto& users = _buffers[stage.buffer].users;
+            wait.insert(wait.end(), users.begin(), users.end());
+        }
+
+        if (!enqueue(stage, wait))
+            return false;
+
+        for (auto input : stage.inputs) {
+            clRetainEvent(stage.done);
+            _buffers[_stages[input].buffer].users.push_back(stage.done);
+        }
+        if (0 <= stage.buffer) {
+            auto& users = _buffers[stage.buffer].users;
+            for (auto event : users)
+                clReleaseEvent(event);
+            users.assign(1, stage.done);
+            clRetainEvent(stage.done);
+        }
+    }
+
+    cl_int err = clFlush(_transform_queue);
+    CHECK("clFlush transforms");
+    err = clFlush(_queue);
+    CHECK("clFlush");
+    return true;
+}
+
+bool FftGraph::enqueue(Stage& stage, std::vector<cl_event>& wait) {
+    cl_int   err   = 0;
+    cl_uint  count = wait.size();
+    cl_event* list = wait.empty() ? NULL : wait.data();
+    cl_mem   out   = 0 <= stage.buffer ? _buffers[stage.buffer].mem : NULL;
+    cl_mem   in    = stage.inputs.empty() ? NULL : _buffers[_stages[stage.inputs[0]].buffer].mem;
+
+    switch (stage.kind) {
+    case UPLOAD:
+        err = clEnqueueWriteBuffer(_queue, out, CL_FALSE, 0, stage.count * sizeof(cl_float),
+                                   stage.source, count, list, &stage.done);
+        CHECK("clEnqueueWriteBuffer graph");
+        break;
+
+    case FORWARD:
+    case BACKWARD:
+        err = clfftEnqueueTransform(FORWARD == stage.kind ? _forward : _backward,
+                                    FORWARD == stage.kind ? CLFFT_FORWARD : CLFFT_BACKWARD,
+                                    1, &_transform_queue, count, list, &stage.done,
+                                    &in, &out, NULL);
+        CHECK("clfftEnqueueTransform graph");
+        break;
+
+    case KERNEL: {
+        cl_uint index = 0;
+        cl_uint outputs = stage.count;
+        for (auto input : stage.inputs)
+            stage.kernel->set_arg(index++, _buffers[_stages[input].buffer].mem);
+        stage.kernel->set_arg(index++, out);
+        stage.kernel->set_arg(index++, outputs);
+        err = clEnqueueNDRangeKernel(_queue, stage.kernel->kernel(), 1, NULL, &stage.count, NULL,
+                                     count, list, &stage.done);
+        CHECK("clEnqueueNDRangeKernel graph");
+        break;
+    }
+
+    case REDUCE: {
+        size_t  width    = _reduce_width;
+        cl_uint values   = _stages[stage.inputs[0]].count;
+        cl_int  subtract = 1 < stage.inputs.size();
+        cl_mem  minus    = subtract ? _buffers[_stages[stage.inputs[1]].buffer].mem : in;
+
+        clGetKernelWorkGroupInfo(_reduce.kernel(), _fft.get_device(), CL_KERNEL_WORK_GROUP_SIZE,
+                                 sizeof(width), &width, NULL);
+        size_t local = 1;
+        while (local * 2 <= std::min(width, _reduce_width))
+            local *= 2;
+
+        _reduce.set_arg(0, in);
+        _reduce.set_arg(1, minus);
+        _reduce.set_arg(2, out);
+        _reduce.set_arg(3, values);
+        _reduce.set_arg(4, subtract);
+        err = clEnqueueNDRangeKernel(_queue, _reduce.kernel(), 1, NULL, &local, &local,
+                                     count, list, &stage.done);
+        CHECK("clEnqueueNDRangeKernel sum_squares");
+        break;
+    }
+
+    case DOWNLOAD:
+        err = clEnqueueReadBuffer(_queue, in, CL_FALSE, 0,
+                                  _stages[stage.inputs[0]].count * sizeof(cl_float),
+                                  stage.target, count, list, &stage.done);
+        CHECK("clEnqueueReadBuffer graph");
+        break;
+    }
+
+    return true;
+}
+
+bool FftGraph::wait() {
+    cl_int err = clFinish(_queue);
+    CHECK("clFinish");
+    err = clFinish(_transform_queue);
+    CHECK("clFinish transforms");
+
+    release_events();
+    return true;
+}
+
+void FftGraph::release_events() {
+    for (auto& stage : _stages) {
+        if (0 != stage.done)
+            clReleaseEvent(stage.done);
+        stage.done = 0;
+    }
+    for (auto& buffer : _buffers) {
+        for (auto event : buffer.users)
+            clReleaseEvent(event);
+        buffer.users.clear();
+    }
+}
+
+size_t FftGraph::get_bytes() {
+    size_t bytes = 0;
+    for (auto& buffer : _buffers)
+        bytes += buffer.bytes;
+    return bytes;
+}
+
+void FftGraph::release() {
+    if (NULL != _queue)
+        clFinish(_queue);
+    if (NULL != _transform_queue)
+        clFinish(_transform_queue);
+    release_events();
+
+    for (auto& buffer : _buffers)
+        clReleaseMemObject(buffer.mem);
+    _buffers.clear();
+
+    for (auto& stage : _stages) {
+        delete stage.kernel;
+        stage.kernel = NULL;
+    }
+    _stages.clear();
+    _reduce.release();
+
+    if (0 != _forward)
+        clfftDestroyPlan(&_forward);
+    if (0 != _backward)
+        clfftDestroyPlan(&_backward);
+    _forward  = 0;
+    _backward = 0;
+
+    if (NULL != _queue)
+        clReleaseCommandQueue(_queue);
+    if (NULL != _transform_queue)
+        clReleaseCommandQueue(_transform_queue);
+    _queue           = NULL;
+    _transform_queue = NULL;
+    _compiled        = false;
+    _valid           = true;
+}
@@ -0,0 +1,104 @@
+#ifndef __FftGraph_hh
+#define __FftGraph_hh
+
+#include <clFFT.h>
+#include <string>
+#include <vector>
+
+#include "fftkernel.hh"
+
+class Fft;
+
+// Chain of device-side stages submitted as one unit.
+//
+// Each stage produces one device value and names the stages it reads;
+// stages can only read earlier ones, so creation order is a valid
+// schedule. compile() gives every value a buffer, reusing a buffer once
+// the last reader of its previous value has been enqueued, and bakes the
+// plans. submit() enqueues everything linked by events only: transfers
+// and kernels on an out-of-order queue when the device offers one, so
+// independent branches overlap, and transforms in order on a queue of
+// their own as clFFT expects. Uploads and downloads name host memory
+// that is read and written on every run.
+//
+// Transforms are length Fft::get_size(), out of place: forward turns N
+// reals into N / 2 + 1 complex bins, backward returns N reals scaled by
+// 1 / N. Custom kernels take their inputs in order, then the output,
+// then the output count as a uint, one work item per output float.
+
+class FftGraph {
+
+public:
+    typedef int Node;
+
+public:
+    FftGraph(Fft& fft);
+    ~FftGraph();
+
+    Node        upload(const cl_float* host, size_t count);
+    Node        forward(Node input);
+    Node        backward(Node input);
+    Node        kernel(const char* source, const char* name, const std::vector<Node>& inputs,
+                       size_t count, const std::string& options = "");
+    Node        sum_squares(Node input, Node minus = -1);   // of input - minus
+    void        download(Node input, cl_float* host);
+
+    bool        compile();
+    bool        submit();
+    bool        wait();
+    bool        run()                       { return submit() && wait(); }
+    void        release();
+
+    size_t      get_count(Node node)        { return _stages.at(node).count; }
+    int         get_buffers()               { return _buffers.size(); }
+    size_t      get_bytes();
+    bool        is_concurrent()             { return _concurrent; }
+
+private:
+    enum Kind   {UPLOAD, FORWARD, BACKWARD, KERNEL, REDUCE, DOWNLOAD};
+
+    struct Stage {
+        Kind                kind;
+        std::vector<Node>   inputs;
+        size_t              count;          // output floats
+        const cl_float*     source;
+        cl_float*           target;
+        FftKernel*          kernel;
+        std::string         options;
+        int                 buffer;
+        int                 last_use;
+        cl_event            done;
+    };
+
+    struct Buffer {
+        cl_mem                  mem;
+        size_t                  bytes;
+        std::vector<cl_event>   users;      // of the value it holds now
+    };
+
+private:
+    Node        add(Kind kind, const std::vector<Node>& inputs, size_t count);
+    bool        setup_queue();
+    bool        setup_plan(clfftPlanHandle* plan, clfftLayout in, clfftLayout out);
+    bool        assign_buffers();
+    bool        enqueue(Stage& stage, std::vector<cl_event>& wait);
+    void        release_events();
+
+private:
+    Fft&                    _fft;
+    size_t                  _size;
+    cl_command_queue        _queue;
+    cl_command_queue        _transform_queue;
+    bool                    _concurrent;
+    bool                    _valid;
+    bool                    _compiled;
+
+    clfftPlanHandle         _forward;
+    clfftPlanHandle         _backward;
+    FftKernel               _reduce;
+
+    std::vector<Stage>      _stages;
+    std::vector<Buffer>     _buffers;
+};
+
+#endif // __FftGraph_hh
@@ -1,5 +1,6 @@
 #include "fftjob.hh"
 
+#include <algorithm>
 #include <ctime>
 #include <cstdlib>
 #include <iostream>
@@ -8,12 +9,30 @@
 #include <random>
 #include <math.h>
 
-FftJob::FftJob(size_t size, double mean, double std) 
+FftJob::FftJob(size_t size, double mean, double std, size_t capacity) 
  : _size(size),
+   _capacity(std::max(capacity, 2 * (size / 2 + 1))),
    _mean(mean),
-   _std(std)
+   _std(std),
+   _channels(1),
+   _stride(1),
+   _owner(true),
+   _lane(-1)
+{
+    _data  = new cl_float[_capacity]();
+}
+
+FftJob::FftJob(cl_float* data, size_t size, size_t capacity, double mean, double std)
+ : _size(size),
+   _capacity(capacity),
+   _mean(mean),
+   _std(std),
+   _channels(1),
+   _stride(1),
+   _data(data),
+   _owner(false),
+   _lane(-1)
 {
-    _data  = new cl_float[_size];
 }
 
 
@@ -21,8 +40,14 @@ FftJob::~FftJob() {
     release();
 }
 
+void FftJob::set_layout(int channels, int stride) {
+    _channels = channels;
+    _stride   = std::max(stride, channels);
+}
+
 void FftJob::copy(FftJob& other) {
-    for (int i = 0; i < _size; ++i) {
+    size_t count = std::min(_capacity, other._capacity);
+    for (size_t i = 0; i < count; ++i) {
         _data[i] = other._data[i];
     }    
 }
@@ -31,10 +56,10 @@ double FftJob::rms(FftJob& inverse) {
     
     double rms = 0;
     
-    for (int i = 0; i < _size; ++i) {
+    for (int i = 0; i < (int) samples(); ++i) {
         rms += pow(inverse.at(i) - at(i), 2);
     }
-    rms /= size();
+    rms /= samples();
     rms = sqrt(rms);
     return rms;
 }
@@ -46,7 +71,7 @@ double FftJob::signal_to_quant_error(FftJob& inverse) {
 
 double FftJob::signal_energy() {
     double energy = 0;
-    for (int i = 0; i < _size; ++i) {
+    for (int i = 0; i < (int) samples(); ++i) {
         energy += pow(at(i), 2);
     }
     return energy;
@@ -55,7 +80,7 @@ double FftJob::signal_energy() {
 double FftJob::quant_error_energy(FftJob& inverse) {
     
     double energy = 0;
-    for (int i = 0; i < _size; ++i) {
+    for (int i = 0; i < (int) samples(); ++i) {
         energy += pow(at(i) - inverse.at(i), 2);
     }
     return energy;
@@ -80,22 +105,23 @@ void FftJob::randomize() {
     
     srand(time(NULL));
 
-    for(int i = 0; i < _size; i++) {
+    for(int i = 0; i < (int) samples(); i++) {
         double number = distribution(generator);
         _data[i]  = number;
     }
 }
 
+// channel c at c + 1 times the base frequency
 void FftJob::periodic() {
-    for (int i = 0; i < _size; ++i) {
-        double t = i * .002;
-        double amp = sin(2 * M_PI * t) + 1; 
+    for (size_t i = 0; i < samples(); ++i) {
+        double t = (i / _stride) * .002;
+        double amp = sin(2 * M_PI * t * (1 + i % _stride)) + 1; 
         _data[i] = amp;
     }
 }
 
 void FftJob::scale(double factor) {
-    for (int i = 0; i < _size; ++i) {
+    for (int i = 0; i < (int) samples(); ++i) {
         _data[i] *= factor;
     }
 }
@@ -118,7 +144,7 @@ void FftJob::write(std::string filename) {
     std::ofstream ofs;
     ofs.open(filename);
     
-    for (int i = 0; i < _size; ++i) {
+    for (int i = 0; i < (int) samples(); ++i) {
         ofs << _data[i] << std::endl;
     }
     
@@ -129,7 +155,7 @@ void FftJob::write_hermitian(std::string filename) {
     std::ofstream ofs;
     ofs.open(filename);
     
-    for (int i = 0; i < _size / 2; ++i) {
+    for (int i = 0; i < size_h(); ++i) {
         auto real = at_hr(i);
         auto imag = at_hi(i);
         auto amplitude = sqrt(pow(real, 2) + pow(imag, 2));
@@ -142,7 +168,8 @@ void FftJob::write_hermitian(std::string filename) {
 
 void FftJob::release() {
     if (NULL != _data) {
-        delete[] _data;
+        if (_owner)
+            delete[] _data;
         _data = NULL;
     }
 }
\ No newline at end of file
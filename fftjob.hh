@@ -1,3 +1,6 @@
+#ifndef __FftJob_hh
+#define __FftJob_hh
+
 #include <clFFT.h>
 #include <string>
 
@@ -6,7 +9,11 @@ public:
     enum TestData  {PERIODIC, RANDOM};
     
 public:
-    FftJob(size_t fft_size, double mean, double std);
+    // capacity is the floats held for the in-place result, by default
+    // room for the N / 2 + 1 bins of a real transform of fft_size
+    FftJob(size_t fft_size, double mean, double std, size_t capacity = 0);
+    FftJob(cl_float* data, size_t fft_size,     // wraps, does not own, data
+           size_t capacity, double mean = 0, double std = 0);
     ~FftJob();
     
 public:
@@ -34,7 +41,19 @@ public:
     cl_float    at_hi(int index)    { return _data[2 * index + 1]; }
     
     int         size()              { return _size; }
-    int         size_h()            { return _size / 2; }
+    int         size_h()            { return _capacity / 2; }
+    size_t      capacity()          { return _capacity; }
+
+    // Interleaved frames: sample t of channel c is at t * stride + c, and
+    // the forward result is one spectrum per channel, channel after channel
+    void        set_layout(int channels, int stride = 0);
+    int         channels()          { return _channels; }
+    int         stride()            { return _stride; }
+    size_t      samples()           { return _size * _stride; }
+
+    // preferred Fft lane for this job, -1 for any
+    int         lane()              { return _lane; }
+    void        set_lane(int lane)  { _lane = lane; }
 
 private:
     void        randomize();
@@ -42,8 +61,15 @@ private:
     
 private:
     size_t      _size;
+    size_t      _capacity;
     double      _mean;
     double      _std;
+    int         _channels;
+    int         _stride;
 
     cl_float*   _data;
-};
\ No newline at end of file
+    bool        _owner;
+    int         _lane;
+};
+
+#endif // __FftJob_hh
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <vector>
+
+#include "fftcache.hh"
+#include "fftkernel.hh"
+
+#define CHECK(MSG)                              \
+    if (err != CL_SUCCESS) {                    \
+      std::cerr << __FILE__ << ":" << __LINE__  \
+          << " Unexpected result for " << MSG   \
+          << " (" << err << ")" << std::endl;   \
+      return false;                             \
+    }
+
+FftKernel::FftKernel(cl_context context, cl_device_id device,
+                     const char* source, const char* name)
+  : _context(context),
+    _device(device),
+    _source(source),
+    _name(name),
+    _program(NULL),
+    _kernel(NULL)
+{
+}
+
+FftKernel::~FftKernel() {
+    release();
+}
+
+bool FftKernel::build(const std::string& options, FftCache* cache) {
+    cl_int err = 0;
+    std::string key;
+
+    // rebuilding replaces the previous program and kernel
+    release();
+
+    if (NULL != cache && cache->enabled()) {
+        key = cache->key(_device, _source, options);
+        _program = cache->load(_context, _device, key, options);
+    }
+
+    if (NULL == _program) {
+        _program = clCreateProgramWithSource(_context, 1, &_source, NULL, &err);
+        CHECK("clCreateProgramWithSource");
+
+        err = clBuildProgram(_program, 1, &_device, options.c_str(), NULL, NULL);
+        if (CL_SUCCESS != err)
+            dump_build_log();
+        CHECK("clBuildProgram");
+
+        if (!key.empty())
+            cache->store(_program, key);
+    }
+
+    _kernel = clCreateKernel(_program, _name, &err);
+    CHECK("clCreateKernel");
+
+    return true;
+}
+
+void FftKernel::release() {
+
+    if (NULL != _kernel) {
+        clReleaseKernel(_kernel);
+        _kernel = NULL;
+    }
+    if (NULL != _program) {
+        clReleaseProgram(_program);
+        _program = NULL;
+    }
+}
+
+void FftKernel::dump_build_log() {
+    size_t size = 0;
+    clGetProgramBuildInfo(_program, _device, CL_PROGRAM_BUILD_LOG, 0, NULL, &size);
+    if (0 == size)
+        return;
+
+    std::vector<char> log(size);
+    clGetProgramBuildInfo(_program, _device, CL_PROGRAM_BUILD_LOG, size, log.data(), NULL);
+    std::cerr << _name << " build log:" << std::endl << log.data() << std::endl;
+}
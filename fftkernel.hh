@@ -0,0 +1,42 @@
+#ifndef __FftKernel_hh
+#define __FftKernel_hh
+
+#include <clFFT.h>
+#include <string>
+
+class FftCache;
+
+// Small OpenCL program wrapper for the helper kernels that run next to the
+// clFFT plans (twiddles, format conversion, ...).
+
+class FftKernel {
+
+public:
+    FftKernel(cl_context context, cl_device_id device, 
+              const char* source, const char* name);
+    ~FftKernel();
+
+    bool        build(const std::string& options = "", FftCache* cache = NULL);
+    void        release();
+
+    cl_kernel   kernel()                    { return _kernel; }
+
+    template<typename T>
+    bool        set_arg(cl_uint index, const T& value) {
+        return CL_SUCCESS == clSetKernelArg(_kernel, index, sizeof(T), &value);
+    }
+
+private:
+    void        dump_build_log();
+
+private:
+    cl_context      _context;
+    cl_device_id    _device;
+    const char*     _source;
+    const char*     _name;
+
+    cl_program      _program;
+    cl_kernel       _kernel;
+};
+
+#endif // __FftKernel_hh
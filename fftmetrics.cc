@@ -0,0 +1,327 @@
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "fftmetrics.hh"
+
+static const char* _counter_names[FftMetrics::COUNTERS] = {
+    "clfft_jobs_submitted_total",
+    "clfft_jobs_completed_total",
+    "clfft_bytes_uploaded_total",
+    "clfft_bytes_downloaded_total",
+    "clfft_plan_bakes_total",
+    "clfft_buffer_waits_total",
+    "clfft_buffer_wait_seconds_total",
+    "clfft_slots",
+    "clfft_slots_in_use",
+};
+
+static const char* _counter_help[FftMetrics::COUNTERS] = {
+    "Transforms submitted",
+    "Transforms completed",
+    "Bytes written to the device",
+    "Bytes read from the device",
+    "clFFT plans baked",
+    "Submits that found every slot busy and waited",
+    "Time submits spent waiting for a slot",
+    "Buffer slots allocated",
+    "Buffer slots holding a submitted job",
+};
+
+static const char* _stage_names[FftMetrics::STAGES] = {"write", "transform", "read", "job"};
+
+static std::atomic<uint64_t> _next_id(1);
+
+FftMetrics::FftMetrics()
+  : _id(_next_id++),
+    _listen(-1),
+    _stopping(false)
+{
+}
+
+FftMetrics::~FftMetrics() {
+    stop();
+    for (auto& entry : _shards)
+        delete entry.second;
+}
+
+int64_t FftMetrics::now() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// The calling thread's shard; the registry is only locked on a thread's
+// first update of this instance
+FftMetrics::Shard* FftMetrics::shard() {
+    thread_local uint64_t owner = 0;
+    thread_local Shard*   cached = NULL;
+
+    if (owner == _id)
+        return cached;
+
+    std::lock_guard<std::mutex> guard(_lock);
+    Shard*& shard = _shards[std::this_thread::get_id()];
+    if (NULL == shard) {
+        shard = new Shard();
+        for (auto& counter : shard->counters)
+            counter = 0;
+        for (auto& stage : shard->buckets)
+            for (auto& bucket : stage)
+                bucket = 0;
+        for (auto& sum : shard->sums)
+            sum = 0;
+    }
+
+    owner  = _id;
+    cached = shard;
+    return shard;
+}
+
+void FftMetrics::add(Counter counter, int64_t value) {
+    shard()->counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void FftMetrics::observe(Stage stage, int64_t ns) {
+    int bucket = 0;
+    while (bucket < BUCKETS && (int64_t(1) << (bucket + 10)) < ns)
+        ++bucket;
+
+    Shard* local = shard();
+    local->buckets[stage][bucket].fetch_add(1, std::memory_order_relaxed);
+    local->sums[stage].fetch_add(ns, std::memory_order_relaxed);
+}
+
+std::string FftMetrics::format() {
+    int64_t  counters[COUNTERS] = {0};
+    uint64_t buckets[STAGES][BUCKETS + 1] = {{0}};
+    int64_t  sums[STAGES] = {0};
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        for (auto& entry : _shards) {
+            Shard* shard = entry.second;
+            for (int i = 0; i < COUNTERS; ++i)
+                counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+            for (int s = 0; s < STAGES; ++s) {
+                for (int b = 0; b <= BUCKETS; ++b)
+                    buckets[s][b] += shard->buckets[s][b].load(std::memory_order_relaxed);
+                sums[s] += shard->sums[s].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::ostringstream text;
+    text.precision(9);
+    for (int i = 0; i < COUNTERS; ++i) {
+        bool gauge = SLOTS == i || SLOTS_BUSY == i;
+        text << "# HELP " << _counter_names[i] << " " << _counter_help[i] << "\n"
+             << "# TYPE " << _counter_names[i] << (gauge ? " gauge" : " counter") << "\n"
+             << _counter_names[i] << " ";
+        if (BLOCKED_NS == i)
+            text << counters[i] * 1e-9 << "\n";
+        else
+            text << counters[i] << "\n";
+    }
+
+    text << "# HELP clfft_queue_depth Transforms submitted and not yet completed\n"
+         << "# TYPE clfft_queue_depth gauge\n"
+         << "clfft_queue_depth " << counters[SUBMITTED] - counters[COMPLETED] << "\n";
+
+    text << "# HELP clfft_stage_seconds Device stage and whole job latency\n"
+         << "# TYPE clfft_stage_seconds histogram\n";
+    for (int s = 0; s < STAGES; ++s) {
+        uint64_t total = 0;
+        for (int b = 0; b <= BUCKETS; ++b) {
+            total += buckets[s][b];
+            text << "clfft_stage_seconds_bucket{stage=\"" << _stage_names[s] << "\",le=\"";
+            if (BUCKETS == b)
+                text << "+Inf";
+            else
+                text << (int64_t(1) << (b + 10)) * 1e-9;
+            text << "\"} " << total << "\n";
+        }
+        text << "clfft_stage_seconds_sum{stage=\"" << _stage_names[s] << "\"} " << sums[s] * 1e-9 << "\n"
+             << "clfft_stage_seconds_count{stage=\"" << _stage_names[s] << "\"} " << total << "\n";
+    }
+
+    return text.str();
+}
+
+// replaced whole, a reader never sees half a scrape
+bool FftMetrics::write(const std::string& path) {
+    std::string temp = path + ".tmp";
+
+    FILE* out = fopen(temp.c_str(), "w");
+    if (NULL == out) {
+        std::cerr << "Error: cannot write metrics " << temp << std::endl;
+        return false;
+    }
+    std::string text = format();
+    bool ok = text.size() == fwrite(text.data(), 1, text.size(), out);
+    ok = 0 == fclose(out) && ok;
+
+    return ok && 0 == rename(temp.c_str(), path.c_str());
+}
+
+bool FftMetrics::start(const std::string& file, const std::string& socket, double interval) {
+    _file     = file;
+    _socket   = socket;
+    _stopping = false;
+
+    if (!_socket.empty() && !listen_socket(_socket)) {
+        if (0 <= _listen)
+            close(_listen);
+        _listen = -1;
+        return false;
+    }
+
+    _exporter = std::thread(&FftMetrics::run, this, std::max(interval, 0.1));
+    return true;
+}
+
+// once, from whichever of the owner and the destructor comes first
+void FftMetrics::stop() {
+    if (!_exporter.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(_stop_lock);
+        _stopping = true;
+    }
+    _stop_signal.notify_all();
+
+    if (_exporter.joinable())
+        _exporter.join();
+
+    if (0 <= _listen) {
+        close(_listen);
+        unlink(_socket.c_str());
+        _listen = -1;
+    }
+
+    // the final values
+    if (!_file.empty())
+        write(_file);
+}
+
+void FftMetrics::run(double interval) {
+    int64_t period = (int64_t) (interval * 1e9);
+    int64_t next   = now();
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> guard(_stop_lock);
+            if (_stopping)
+                break;
+        }
+
+        if (now() >= next) {
+            if (!_file.empty())
+                write(_file);
+            next += period;
+        }
+
+        int wait_ms = (int) std::min<int64_t>(std::max<int64_t>(next - now(), 0) / 1000000, 500);
+        if (0 <= _listen) {
+            serve(wait_ms);
+        } else {
+            std::unique_lock<std::mutex> guard(_stop_lock);
+            _stop_signal.wait_for(guard, std::chrono::milliseconds(wait_ms), [this] { return _stopping; });
+        }
+    }
+}
+
+bool FftMetrics::listen_socket(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (sizeof(addr.sun_path) <= path.size()) {
+        std::cerr << "Socket path too long: " << path << std::endl;
+        return false;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    if (!remove_stale(path, addr))
+        return false;
+
+    _listen = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_listen < 0 ||
+        0 != bind(_listen, (sockaddr*) &addr, sizeof(addr)) ||
+        0 != listen(_listen, 4)) {
+        std::cerr << "Unable to listen on " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Only a socket nobody answers on is replaced, never another kind of file
+bool FftMetrics::remove_stale(const std::string& path, const sockaddr_un& addr) {
+    struct stat st;
+    if (0 != lstat(path.c_str(), &st))
+        return ENOENT == errno;
+
+    if (!S_ISSOCK(st.st_mode)) {
+        std::cerr << "Error: " << path << " exists and is not a socket" << std::endl;
+        return false;
+    }
+
+    int  probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool live  = 0 <= probe && 0 == connect(probe, (const sockaddr*) &addr, sizeof(addr));
+    if (0 <= probe)
+        close(probe);
+    if (live) {
+        std::cerr << "Error: " << path << " is already being served" << std::endl;
+        return false;
+    }
+
+    return 0 == unlink(path.c_str());
+}
+
+// One scrape per connection: plain text, or an HTTP response to a GET
+// (curl --unix-socket)
+void FftMetrics::serve(int timeout_ms) {
+    pollfd listen_fd = {_listen, POLLIN, 0};
+    if (poll(&listen_fd, 1, timeout_ms) <= 0)
+        return;
+
+    int fd = accept(_listen, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    char request[512];
+    ssize_t count = 0;
+    pollfd client = {fd, POLLIN, 0};
+    if (0 < poll(&client, 1, 100))
+        count = recv(fd, request, sizeof(request), MSG_DONTWAIT);
+
+    std::string text = format();
+    if (4 <= count && 0 == memcmp(request, "GET ", 4))
+        text = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+               "Content-Length: " + std::to_string(text.size()) + "\r\n\r\n" + text;
+
+    const char* data = text.data();
+    size_t      left = text.size();
+    while (0 < left) {
+        ssize_t sent = send(fd, data, left, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (EINTR == errno)
+                continue;
+            break;
+        }
+        data += sent;
+        left -= sent;
+    }
+    close(fd);
+}
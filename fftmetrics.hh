@@ -0,0 +1,80 @@
+#ifndef __FftMetrics_hh
+#define __FftMetrics_hh
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <sys/un.h>
+
+// Running counters, gauges and latency histograms of the transform path,
+// exported in the Prometheus text format.
+//
+// Every thread updates its own shard with relaxed atomics, so the hot
+// path never takes a lock; a scrape sums the shards. The exporter thread
+// rewrites a text file every interval (for node_exporter's textfile
+// collector, or plain tail) and/or answers each connection on a Unix
+// socket with the current values.
+
+class FftMetrics {
+
+public:
+    enum Counter {SUBMITTED, COMPLETED, BYTES_UP, BYTES_DOWN, PLAN_BAKES,
+                  BUFFER_WAITS, BLOCKED_NS, SLOTS, SLOTS_BUSY, COUNTERS};
+
+    // device stages from profiling, and a job from submit to completion
+    enum Stage   {WRITE, TRANSFORM, READ, JOB, STAGES};
+
+    // power of two ns bounds, 1 us to 8.6 s, then +Inf
+    static const int BUCKETS = 24;
+
+public:
+    FftMetrics();
+    ~FftMetrics();
+
+    void        add(Counter counter, int64_t value = 1);
+    void        observe(Stage stage, int64_t ns);
+
+    std::string format();
+    bool        write(const std::string& path);
+
+    // export every interval seconds to a file, a socket, or both
+    bool        start(const std::string& file, const std::string& socket, double interval);
+    void        stop();
+
+    static int64_t now();
+
+private:
+    struct Shard {
+        std::atomic<int64_t>    counters[COUNTERS];
+        std::atomic<uint64_t>   buckets[STAGES][BUCKETS + 1];
+        std::atomic<int64_t>    sums[STAGES];
+    };
+
+private:
+    Shard*      shard();
+    bool        listen_socket(const std::string& path);
+    bool        remove_stale(const std::string& path, const sockaddr_un& addr);
+    void        serve(int timeout_ms);
+    void        run(double interval);
+
+private:
+    uint64_t                _id;
+
+    std::mutex              _lock;
+    std::map<std::thread::id, Shard*> _shards;
+
+    std::string             _file;
+    std::string             _socket;
+    int                     _listen;
+    std::thread             _exporter;
+    std::mutex              _stop_lock;
+    std::condition_variable _stop_signal;
+    bool                    _stopping;
+};
+
+#endif // __FftMetrics_hh
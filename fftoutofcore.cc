@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <iostream>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fft.hh"
+#include "fftoutofcore.hh"
+
+#define CHECK(MSG)                              \
+    if (err != CL_SUCCESS) {                    \
+      std::cerr << __FILE__ << ":" << __LINE__  \
+          << " Unexpected result for " << MSG   \
+          << " (" << err << ")" << std::endl;   \
+      return false;                             \
+    }
+
+// Multiply column j (n2 = col0 + j) of a block by W_N^(n2 * k1). The product
+// n2 * k1 is below N and exact as an integer, but not as a float once N
+// passes 2^24. With fp64 the phase is taken in double; otherwise the whole
+// quarter turns of 4 m / N are split off in integers and applied exactly,
+// so the float sincos only sees the remainder, under a quarter turn.
+static const char* _twiddle_source =
+"#ifdef TWIDDLE_DOUBLE                                              \n"
+"#pragma OPENCL EXTENSION cl_khr_fp64 : enable                      \n"
+"#endif                                                             \n"
+"__kernel void twiddle(__global float2* data, uint length,          \n"
+"                      ulong col0, ulong size)                      \n"
+"{                                                                  \n"
+"    size_t k1  = get_global_id(0);                                 \n"
+"    size_t j   = get_global_id(1);                                 \n"
+"    ulong  m   = (col0 + j) * k1;                                  \n"
+"    float  c;                                                      \n"
+"    float  s;                                                      \n"
+"#ifdef TWIDDLE_DOUBLE                                              \n"
+"    double dc;                                                     \n"
+"    double ds  = sincos(-2.0 * M_PI * ((double) m / (double) size), &dc);\n"
+"    c = (float) dc;                                                \n"
+"    s = (float) ds;                                                \n"
+"#else                                                              \n"
+"    ulong  q   = 4 * m / size;                                     \n"
+"    ulong  r   = 4 * m - q * size;                                 \n"
+"    float  rc;                                                     \n"
+"    float  rs  = sincos(-0.5f * M_PI_F * ((float) r / (float) size), &rc);\n"
+"    switch (q) {                    /* times (-i)^q */             \n"
+"    case 0:  c =  rc; s =  rs; break;                              \n"
+"    case 1:  c =  rs; s = -rc; break;                              \n"
+"    case 2:  c = -rc; s = -rs; break;                              \n"
+"    default: c = -rs; s =  rc; break;                              \n"
+"    }                                                              \n"
+"#endif                                                             \n"
+"    size_t idx = j * length + k1;                                  \n"
+"    float2 v   = data[idx];                                        \n"
+"    data[idx]  = (float2)(v.x * c - v.y * s, v.x * s + v.y * c);   \n"
+"}                                                                  \n";
+
+static size_t largest_divisor(size_t n, size_t limit) {
+    for (size_t d = std::min(n, std::max(limit, (size_t) 1)); d > 1; --d) {
+        if (0 == n % d)
+            return d;
+    }
+    return 1;
+}
+
+static void* map_file(int fd, size_t bytes, int prot) {
+    void* addr = mmap(NULL, bytes, prot, MAP_SHARED, fd, 0);
+    return MAP_FAILED == addr ? NULL : addr;
+}
+
+FftOutOfCore::FftOutOfCore(Fft& fft, size_t block_bytes)
+  : _fft(fft),
+    _block_bytes(block_bytes),
+    _size(0),
+    _rows(0),
+    _cols(0),
+    _col_batch(0),
+    _row_batch(0),
+    _input(NULL),
+    _scratch(NULL),
+    _output(NULL),
+    _twiddle(fft.get_context(), fft.get_device(), _twiddle_source, "twiddle")
+{
+    for (auto& stage : _stage) {
+        stage.buf   = NULL;
+        stage.done  = NULL;
+        stage.block = 0;
+        stage.busy  = false;
+    }
+}
+
+FftOutOfCore::~FftOutOfCore() {
+    release_stages();
+    unmap_files();
+}
+
+bool FftOutOfCore::transform(const std::string& input, const std::string& output) {
+
+    if (!map_files(input, output))
+        return false;
+
+    // the twiddle kernel depends only on the device, build it on first use
+    bool twiddle = NULL != _twiddle.kernel() ||
+                   _twiddle.build(has_fp64() ? "-DTWIDDLE_DOUBLE" : "", _fft.get_cache());
+    if (!factor() || !twiddle) {
+        unmap_files();
+        return false;
+    }
+
+    bool ok = column_pass() && row_pass();
+
+    release_stages();
+    unmap_files();
+    return ok;
+}
+
+bool FftOutOfCore::has_fp64() {
+    char extensions[4096] = {0};
+    clGetDeviceInfo(_fft.get_device(), CL_DEVICE_EXTENSIONS, 
+                    sizeof(extensions) - 1, extensions, NULL);
+    return NULL != strstr(extensions, "cl_khr_fp64");
+}
+
+bool FftOutOfCore::factor() {
+
+    // clFFT handles lengths built from radix 2, 3, 5 and 7
+    size_t n = _size;
+    for (size_t radix : {2, 3, 5, 7}) {
+        while (0 == n % radix)
+            n /= radix;
+    }
+    if (1 != n || _size < 4) {
+        std::cerr << "Out-of-core size " << _size 
+                  << " must be a product of 2, 3, 5 and 7" << std::endl;
+        return false;
+    }
+
+    // split as close to square as possible
+    _rows = largest_divisor(_size, (size_t) sqrt((double) _size));
+    _cols = _size / _rows;
+
+    // size the blocks so that both stages together fit in the budget, and
+    // each in a single allocation
+    cl_ulong max_alloc = 0;
+    clGetDeviceInfo(_fft.get_device(), CL_DEVICE_MAX_MEM_ALLOC_SIZE, 
+                    sizeof(max_alloc), &max_alloc, NULL);
+    size_t budget = _block_bytes / 2;
+    if (0 != max_alloc && max_alloc < budget)
+        budget = max_alloc;
+
+    size_t complex_bytes = 2 * sizeof(cl_float);
+    _col_batch = largest_divisor(_cols, budget / (_rows * complex_bytes));
+    _row_batch = largest_divisor(_rows, budget / (_cols * complex_bytes));
+
+    if (budget < _rows * complex_bytes || budget < _cols * complex_bytes) {
+        std::cerr << "Out-of-core stage of " << budget 
+                  << " bytes cannot hold a single row or column" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool FftOutOfCore::map_files(const std::string& input, const std::string& output) {
+
+    int in = open(input.c_str(), O_RDONLY);
+    if (in < 0) {
+        std::cerr << "Unable to open " << input << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (0 != fstat(in, &st)) {
+        std::cerr << "Unable to stat " << input << ": " << strerror(errno) << std::endl;
+        close(in);
+        return false;
+    }
+    if (0 != st.st_size % sizeof(cl_float)) {
+        std::cerr << input << " holds " << st.st_size << " bytes, not a whole number of floats" << std::endl;
+        close(in);
+        return false;
+    }
+    _size = st.st_size / sizeof(cl_float);
+
+    size_t out_bytes = _size * 2 * sizeof(cl_float);
+    std::string scratch = output + ".tmp";
+
+    int out = open(output.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int tmp = open(scratch.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    unlink(scratch.c_str());
+
+    bool ok = 0 < _size && 0 <= out && 0 <= tmp &&
+              0 == ftruncate(out, out_bytes) &&
+              0 == ftruncate(tmp, out_bytes);
+    if (ok) {
+        _input   = (const cl_float*) map_file(in, _size * sizeof(cl_float), PROT_READ);
+        _output  = (cl_float*) map_file(out, out_bytes, PROT_READ | PROT_WRITE);
+        _scratch = (cl_float*) map_file(tmp, out_bytes, PROT_READ | PROT_WRITE);
+        ok = NULL != _input && NULL != _output && NULL != _scratch;
+    }
+
+    // the mappings keep the files alive
+    close(in);
+    if (0 <= out) close(out);
+    if (0 <= tmp) close(tmp);
+
+    if (!ok) {
+        std::cerr << "Unable to map " << input << " -> " << output << std::endl;
+        unmap_files();
+        return false;
+    }
+
+    madvise((void*) _input, _size * sizeof(cl_float), MADV_SEQUENTIAL);
+    return true;
+}
+
+void FftOutOfCore::unmap_files() {
+    size_t out_bytes = _size * 2 * sizeof(cl_float);
+
+    if (NULL != _input) {
+        munmap((void*) _input, _size * sizeof(cl_float));
+        _input = NULL;
+    }
+    if (NULL != _output) {
+        munmap(_output, out_bytes);
+        _output = NULL;
+    }
+    if (NULL != _scratch) {
+        munmap(_scratch, out_bytes);
+        _scratch = NULL;
+    }
+}
+
+bool FftOutOfCore::setup_plan(clfftPlanHandle* plan, size_t length, size_t batch) {
+    cl_int err = 0;
+    cl_command_queue queue = _fft.get_queue();
+
+    err = clfftCreateDefaultPlan(plan, _fft.get_context(), CLFFT_1D, &length);
+    CHECK("clfftCreateDefaultPlan");
+
+    err = clfftSetPlanPrecision(*plan, CLFFT_SINGLE);
+    CHECK("clfftSetPlanPrecision");
+    err = clfftSetLayout(*plan, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED);
+    CHECK("clfftSetLayout");
+    err = clfftSetResultLocation(*plan, CLFFT_INPLACE);
+    CHECK("clfftSetResultLocation");
+    err = clfftSetPlanBatchSize(*plan, batch);
+    CHECK("clfftSetPlanBatchSize");
+    err = clfftSetPlanDistance(*plan, length, length);
+    CHECK("clfftSetPlanDistance");
+
+    err = clfftBakePlan(*plan, 1, &queue, NULL, NULL);
+    CHECK("clfftBakePlan");
+
+    return true;
+}
+
+bool FftOutOfCore::setup_stages(size_t bytes) {
+    cl_int err = 0;
+
+    for (auto& stage : _stage) {
+        stage.buf = clCreateBuffer(_fft.get_context(), CL_MEM_READ_WRITE, bytes, NULL, &err);
+        CHECK("clCreateBuffer stage");
+        stage.host.resize(bytes / sizeof(cl_float));
+        stage.busy = false;
+    }
+
+    return true;
+}
+
+void FftOutOfCore::release_stages() {
+    for (auto& stage : _stage) {
+        if (NULL != stage.done) {
+            clReleaseEvent(stage.done);
+            stage.done = NULL;
+        }
+        if (NULL != stage.buf) {
+            clReleaseMemObject(stage.buf);
+            stage.buf = NULL;
+        }
+        stage.host.clear();
+        stage.host.shrink_to_fit();
+        stage.busy = false;
+    }
+}
+
+// Double buffered block pipeline: while the device works on one stage the
+// host scatters the previous result and gathers the next block into the other.
+bool FftOutOfCore::stream(clfftPlanHandle plan, size_t length, size_t batch, 
+                          size_t blocks, bool twiddle, Stream gather, Stream scatter) {
+    cl_int err = 0;
+    cl_command_queue queue = _fft.get_queue();
+    size_t bytes = length * batch * 2 * sizeof(cl_float);
+
+    for (size_t block = 0; block < blocks; ++block) {
+        Stage& stage = _stage[block % 2];
+
+        if (stage.busy && !drain(stage, scatter))
+            return false;
+
+        gather(block, stage.host.data());
+
+        cl_event write = 0;
+        cl_event transform = 0;
+        cl_event ready = 0;
+
+        err = clEnqueueWriteBuffer(queue, stage.buf, CL_FALSE, 0, bytes, 
+                                   stage.host.data(), 0, NULL, &write);
+        CHECK("clEnqueueWriteBuffer");
+
+        err = clfftEnqueueTransform(plan, CLFFT_FORWARD, 1, &queue, 1, &write, &transform,
+                                    &stage.buf, NULL, NULL);
+        CHECK("clfftEnqueueTransform");
+        ready = transform;
+
+        if (twiddle) {
+            cl_kernel kernel = _twiddle.kernel();
+            cl_uint   len    = length;
+            cl_ulong  col0   = block * batch;
+            cl_ulong  size   = _size;
+            size_t    global[2] = {length, batch};
+
+            _twiddle.set_arg(0, stage.buf);
+            _twiddle.set_arg(1, len);
+            _twiddle.set_arg(2, col0);
+            _twiddle.set_arg(3, size);
+
+            err = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, NULL, 
+                                         1, &transform, &ready);
+            CHECK("clEnqueueNDRangeKernel twiddle");
+        }
+
+        err = clEnqueueReadBuffer(queue, stage.buf, CL_FALSE, 0, bytes,
+                                  stage.host.data(), 1, &ready, &stage.done);
+        CHECK("clEnqueueReadBuffer");
+
+        clReleaseEvent(write);
+        clReleaseEvent(transform);
+        if (twiddle)
+            clReleaseEvent(ready);
+        clFlush(queue);
+
+        stage.block = block;
+        stage.busy  = true;
+    }
+
+    // collect the last blocks in submission order
+    for (size_t i = 0; i < 2; ++i) {
+        Stage& stage = _stage[(blocks + i) % 2];
+        if (stage.busy && !drain(stage, scatter))
+            return false;
+    }
+
+    return true;
+}
+
+bool FftOutOfCore::drain(Stage& stage, Stream scatter) {
+    cl_int err = clWaitForEvents(1, &stage.done);
+    CHECK("clWaitForEvents");
+
+    clReleaseEvent(stage.done);
+    stage.done = NULL;
+    stage.busy = false;
+
+    scatter(stage.block, stage.host.data());
+    return true;
+}
+
+bool FftOutOfCore::column_pass() {
+    clfftPlanHandle plan;
+    size_t rows  = _rows;
+    size_t cols  = _cols;
+    size_t batch = _col_batch;
+
+    size_t bytes = std::max(_col_batch * _rows, _row_batch * _cols) * 2 * sizeof(cl_float);
+    if (!setup_stages(bytes) || !setup_plan(&plan, rows, batch))
+        return false;
+
+    // strided columns of the input become contiguous complex transforms
+    auto gather = [=](size_t block, cl_float* host) {
+        size_t col0 = block * batch;
+        for (size_t n1 = 0; n1 < rows; ++n1) {
+            const cl_float* src = _input + n1 * cols + col0;
+            for (size_t j = 0; j < batch; ++j) {
+                host[2 * (j * rows + n1)]     = src[j];
+                host[2 * (j * rows + n1) + 1] = 0;
+            }
+        }
+    };
+
+    // and are stored back as row k1 of the scratch matrix
+    auto scatter = [=](size_t block, cl_float* host) {
+        size_t col0 = block * batch;
+        for (size_t k1 = 0; k1 < rows; ++k1) {
+            cl_float* dst = _scratch + 2 * (k1 * cols + col0);
+            for (size_t j = 0; j < batch; ++j) {
+                dst[2 * j]     = host[2 * (j * rows + k1)];
+                dst[2 * j + 1] = host[2 * (j * rows + k1) + 1];
+            }
+        }
+    };
+
+    bool ok = stream(plan, rows, batch, cols / batch, true, gather, scatter);
+    clfftDestroyPlan(&plan);
+    return ok;
+}
+
+bool FftOutOfCore::row_pass() {
+    clfftPlanHandle plan;
+    size_t rows  = _rows;
+    size_t cols  = _cols;
+    size_t batch = _row_batch;
+
+    if (!setup_plan(&plan, cols, batch))
+        return false;
+
+    auto gather = [=](size_t block, cl_float* host) {
+        memcpy(host, _scratch + 2 * block * batch * cols, 
+               batch * cols * 2 * sizeof(cl_float));
+    };
+
+    // X[k1 + N1 * k2] - transpose into natural order
+    auto scatter = [=](size_t block, cl_float* host) {
+        size_t row0 = block * batch;
+        for (size_t k2 = 0; k2 < cols; ++k2) {
+            cl_float* dst = _output + 2 * (k2 * rows + row0);
+            for (size_t r = 0; r < batch; ++r) {
+                dst[2 * r]     = host[2 * (r * cols + k2)];
+                dst[2 * r + 1] = host[2 * (r * cols + k2) + 1];
+            }
+        }
+    };
+
+    bool ok = stream(plan, cols, batch, rows / batch, false, gather, scatter);
+    clfftDestroyPlan(&plan);
+    return ok;
+}
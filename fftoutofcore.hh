@@ -0,0 +1,81 @@
+#ifndef __FftOutOfCore_hh
+#define __FftOutOfCore_hh
+
+#include <clFFT.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "fftkernel.hh"
+
+class Fft;
+
+// Four-step FFT for transforms that do not fit in device memory.
+//
+// The input is a raw file of cl_float samples, viewed as an N1 x N2 matrix
+// (n = n1 * N2 + n2). Blocks of columns are streamed to the device for the
+// N1 point transforms and twiddle multiplication, then blocks of rows for the
+// N2 point transforms. The full complex spectrum (interleaved cl_float pairs,
+// N bins) is written to the output file in natural order. block_bytes bounds
+// the device memory of the two double-buffered stages together.
+
+class FftOutOfCore {
+
+public:
+    FftOutOfCore(Fft& fft, size_t block_bytes);
+    ~FftOutOfCore();
+
+    bool        transform(const std::string& input, const std::string& output);
+
+    size_t      get_size()                  { return _size; }
+    size_t      get_rows()                  { return _rows; }
+    size_t      get_cols()                  { return _cols; }
+    size_t      get_col_batch()             { return _col_batch; }
+    size_t      get_row_batch()             { return _row_batch; }
+
+private:
+    typedef std::function<void(size_t, cl_float*)> Stream;
+
+    struct Stage {
+        cl_mem                  buf;
+        std::vector<cl_float>   host;
+        cl_event                done;
+        size_t                  block;
+        bool                    busy;
+    };
+
+    bool        factor();
+    bool        has_fp64();
+    bool        map_files(const std::string& input, const std::string& output);
+    void        unmap_files();
+
+    bool        setup_plan(clfftPlanHandle* plan, size_t length, size_t batch);
+    bool        setup_stages(size_t bytes);
+    void        release_stages();
+
+    bool        stream(clfftPlanHandle plan, size_t length, size_t batch, 
+                       size_t blocks, bool twiddle, Stream gather, Stream scatter);
+    bool        drain(Stage& stage, Stream scatter);
+
+    bool        column_pass();
+    bool        row_pass();
+
+private:
+    Fft&            _fft;
+    size_t          _block_bytes;
+
+    size_t          _size;
+    size_t          _rows;
+    size_t          _cols;
+    size_t          _col_batch;
+    size_t          _row_batch;
+
+    const cl_float* _input;
+    cl_float*       _scratch;
+    cl_float*       _output;
+
+    FftKernel       _twiddle;
+    Stage           _stage[2];
+};
+
+#endif // __FftOutOfCore_hh
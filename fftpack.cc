@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FFT_PACK_X86
+#include <immintrin.h>
+#endif
+
+#include "fftpack.hh"
+
+static cl_half float_to_half(float value) {
+    uint32_t x;
+    memcpy(&x, &value, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x007fffff;
+    int32_t  exp  = (int32_t) ((x >> 23) & 0xff) - 127 + 15;
+
+    // inf / nan
+    if (0xff == ((x >> 23) & 0xff))
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+
+    // overflow
+    if (0x1f <= exp)
+        return sign | 0x7c00;
+
+    // subnormal or zero
+    if (exp <= 0) {
+        if (exp < -10)
+            return sign;
+        mant |= 0x00800000;
+        uint32_t shift = 14 - exp;
+        uint32_t half  = mant >> shift;
+        uint32_t rem   = mant & ((1u << shift) - 1);
+        uint32_t mid   = 1u << (shift - 1);
+        if (rem > mid || (rem == mid && (half & 1)))
+            ++half;
+        return sign | half;
+    }
+
+    // round to nearest even, a carry correctly rolls into the exponent
+    uint32_t half = sign | (exp << 10) | (mant >> 13);
+    uint32_t rem  = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+        ++half;
+    return half;
+}
+
+static float half_to_float(cl_half value) {
+    uint32_t sign = (uint32_t) (value & 0x8000) << 16;
+    uint32_t exp  = (value >> 10) & 0x1f;
+    uint32_t mant = value & 0x3ff;
+    uint32_t x;
+
+    if (0x1f == exp) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else if (0 == exp) {
+        if (0 == mant) {
+            x = sign;
+        } else {
+            // normalize the subnormal
+            exp = 113;
+            while (0 == (mant & 0x400)) {
+                mant <<= 1;
+                --exp;
+            }
+            x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
+    } else {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+
+    float result;
+    memcpy(&result, &x, sizeof(result));
+    return result;
+}
+
+#ifdef FFT_PACK_X86
+
+__attribute__((target("avx,f16c")))
+static void pack_half_f16c(const cl_float* in, cl_half* out, size_t count, float scale) {
+    __m256 factor = _mm256_set1_ps(scale);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256  v = _mm256_mul_ps(_mm256_loadu_ps(in + i), factor);
+        __m128i h = _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*) (out + i), h);
+    }
+    for (; i < count; ++i)
+        out[i] = float_to_half(in[i] * scale);
+}
+
+__attribute__((target("avx,f16c")))
+static void unpack_half_f16c(const cl_half* in, cl_float* out, size_t count, float scale) {
+    __m256 factor = _mm256_set1_ps(scale);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i*) (in + i));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtph_ps(h), factor));
+    }
+    for (; i < count; ++i)
+        out[i] = half_to_float(in[i]) * scale;
+}
+
+static bool has_f16c() {
+    static bool f16c = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    return f16c;
+}
+
+#endif // FFT_PACK_X86
+
+void pack_half(const cl_float* in, cl_half* out, size_t count, float scale) {
+#ifdef FFT_PACK_X86
+    if (has_f16c()) {
+        pack_half_f16c(in, out, count, scale);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i)
+        out[i] = float_to_half(in[i] * scale);
+}
+
+void unpack_half(const cl_half* in, cl_float* out, size_t count, float scale) {
+#ifdef FFT_PACK_X86
+    if (has_f16c()) {
+        unpack_half_f16c(in, out, count, scale);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i)
+        out[i] = half_to_float(in[i]) * scale;
+}
+
+float pack_int16(const cl_float* in, cl_short* out, size_t count) {
+    size_t i = 0;
+    float  peak = 0;
+
+#ifdef __SSE2__
+    __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 max = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4)
+        max = _mm_max_ps(max, _mm_and_ps(_mm_loadu_ps(in + i), abs_mask));
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, max);
+    for (float lane : lanes)
+        peak = std::max(peak, lane);
+#endif
+    for (; i < count; ++i)
+        peak = std::max(peak, std::fabs(in[i]));
+
+    float scale   = 0 < peak ? peak / 32767.0f : 1.0f;
+    float inverse = 1.0f / scale;
+    i = 0;
+
+#ifdef __SSE2__
+    __m128 factor = _mm_set1_ps(inverse);
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i), factor));
+        __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + i + 4), factor));
+        _mm_storeu_si128((__m128i*) (out + i), _mm_packs_epi32(lo, hi));
+    }
+#endif
+    for (; i < count; ++i)
+        out[i] = (cl_short) lrintf(std::max(-32767.0f, std::min(32767.0f, in[i] * inverse)));
+
+    return scale;
+}
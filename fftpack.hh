@@ -0,0 +1,15 @@
+#ifndef __FftPack_hh
+#define __FftPack_hh
+
+#include <clFFT.h>
+
+// Host side packing of samples for the compressed transfer modes. The x86
+// paths use F16C / SSE2 when the CPU has them, otherwise a scalar fallback.
+
+void    pack_half(const cl_float* in, cl_half* out, size_t count, float scale = 1);
+void    unpack_half(const cl_half* in, cl_float* out, size_t count, float scale = 1);
+
+// Returns the factor that converts the packed values back to floats
+float   pack_int16(const cl_float* in, cl_short* out, size_t count);
+
+#endif // __FftPack_hh
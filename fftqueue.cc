@@ -0,0 +1,891 @@
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+#include "fft.hh"
+#include "fftpack.hh"
+
+#define CHECK(MSG)                              \
+    if (err != CL_SUCCESS) {                    \
+      std::cerr << __FILE__ << ":" << __LINE__  \
+          << " Unexpected result for " << MSG   \
+          << " (" << err << ")" << std::endl;   \
+      return false;                             \
+    }
+
+// Conversion between the packed transfer formats and the float plan data
+static const char* _unpack_half_source =
+"__kernel void unpack(__global const half* in, __global float* out, float scale) \n"
+"{                                                                              \n"
+"    size_t i = get_global_id(0);                                               \n"
+"    out[i] = vload_half(i, in) * scale;                                        \n"
+"}                                                                              \n";
+
+static const char* _unpack_int16_source =
+"__kernel void unpack(__global const short* in, __global float* out, float scale)\n"
+"{                                                                              \n"
+"    size_t i = get_global_id(0);                                               \n"
+"    out[i] = in[i] * scale;                                                    \n"
+"}                                                                              \n";
+
+static const char* _pack_half_source =
+"__kernel void pack(__global const float* in, __global half* out, float scale)  \n"
+"{                                                                              \n"
+"    size_t i = get_global_id(0);                                               \n"
+"    vstore_half(in[i] * scale, i, out);                                        \n"
+"}                                                                              \n";
+
+// Bluestein: X_k = c_k * sum_j (x_j c_j) conj(c)_(k-j), c_m = e^(-i pi m^2 / N),
+// with the convolution done by M point transforms. The inverse swaps the
+// chirp signs. m^2 is reduced mod 2N in integers to keep the phase exact.
+static const char* _bluestein_source =
+"float2 chirp(ulong i, uint n, int sign)                                       \n"
+"{                                                                             \n"
+"    ulong r = (i * i) % (2 * (ulong) n);                                      \n"
+"    float c;                                                                  \n"
+"    float s = sincos(sign * M_PI_F * ((float) r / (float) n), &c);            \n"
+"    return (float2)(c, s);                                                    \n"
+"}                                                                             \n"
+"                                                                              \n"
+"float2 cmul(float2 a, float2 b)                                               \n"
+"{                                                                             \n"
+"    return (float2)(a.x * b.x - a.y * b.y, a.x * b.y + a.y * b.x);            \n"
+"}                                                                             \n"
+"                                                                              \n"
+"__kernel void chirp_b(__global float2* b, uint n, uint m, int sign)           \n"
+"{                                                                             \n"
+"    size_t i = get_global_id(0);                                              \n"
+"    float2 v = (float2)(0, 0);                                                \n"
+"    if (i < n)                                                                \n"
+"        v = chirp(i, n, sign);                                                \n"
+"    else if (m - i < n)                                                       \n"
+"        v = chirp(m - i, n, sign);                                            \n"
+"    b[i] = v;                                                                 \n"
+"}                                                                             \n"
+"                                                                              \n"
+"__kernel void chirp_pre(__global const float* in, __global float2* a,        \n"
+"                        uint n, int sign, int hermitian)                      \n"
+"{                                                                             \n"
+"    size_t i = get_global_id(0);                                              \n"
+"    float2 v = (float2)(0, 0);                                                \n"
+"    if (i < n) {                                                              \n"
+"        if (!hermitian)                                                       \n"
+"            v = (float2)(in[i], 0);                                           \n"
+"        else if (i <= n / 2)                                                  \n"
+"            v = (float2)(in[2 * i], in[2 * i + 1]);                           \n"
+"        else                                                                  \n"
+"            v = (float2)(in[2 * (n - i)], -in[2 * (n - i) + 1]);              \n"
+"        v = cmul(v, chirp(i, n, sign));                                       \n"
+"    }                                                                         \n"
+"    a[i] = v;                                                                 \n"
+"}                                                                             \n"
+"                                                                              \n"
+"__kernel void chirp_mul(__global float2* a, __global const float2* b)        \n"
+"{                                                                             \n"
+"    size_t i = get_global_id(0);                                              \n"
+"    a[i] = cmul(a[i], b[i]);                                                  \n"
+"}                                                                             \n"
+"                                                                              \n"
+"__kernel void chirp_post(__global const float2* a, __global float* out,      \n"
+"                         uint n, int sign, int hermitian)                     \n"
+"{                                                                             \n"
+"    size_t k = get_global_id(0);                                              \n"
+"    float2 v = cmul(a[k], chirp(k, n, sign));                                 \n"
+"    if (hermitian) {                                                          \n"
+"        out[2 * k]     = v.x;                                                 \n"
+"        out[2 * k + 1] = v.y;                                                 \n"
+"    } else {                                                                  \n"
+"        out[k] = v.x / n;                                                     \n"
+"    }                                                                         \n"
+"}                                                                             \n";
+
+FftQueue::FftQueue(Fft& fft, int index, cl_platform_id platform, cl_device_id device)
+  : _fft(fft),
+    _index(index),
+    _platform(platform),
+    _device(device),
+    _context(NULL),
+    _queue(NULL),
+    _forward(0),
+    _backward(0),
+    _unpack(NULL),
+    _pack(NULL),
+    _chirp_b(NULL),
+    _chirp_pre(NULL),
+    _chirp_mul(NULL),
+    _chirp_post(NULL),
+    _chirp_forward(NULL),
+    _chirp_backward(NULL),
+    _slab(NULL),
+    _host_slab(NULL),
+    _staging(NULL),
+    _temp_buf(NULL),
+    _align(1),
+    _max_alloc(0),
+    _issued(0),
+    _trace_offset(0)
+{
+    memset(_offsets, 0, sizeof(_offsets));
+    memset(_strides, 0, sizeof(_strides));
+}
+
+FftQueue::~FftQueue() {
+    shutdown();
+}
+
+bool FftQueue::init(int slots, size_t budget) {
+    size_t length = _fft.get_plan_size();
+
+    // Bluestein runs both directions through one complex plan
+    if (_fft.is_bluestein()) {
+        if (!setup_plan(&_forward, length, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED) ||
+            !setup_bluestein())
+            return false;
+    } else if (_fft.is_strided()) {
+        if (!setup_strided_plan(&_forward, length, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED) ||
+            !setup_strided_plan(&_backward, length, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL))
+            return false;
+    } else {
+        if (!setup_plan(&_forward, length, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED) ||
+            !setup_plan(&_backward, length, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL))
+            return false;
+    }
+
+    if (setup_kernels() &&
+        setup_buffers(slots, budget))
+        return true;
+    return false;
+}
+
+void FftQueue::shutdown() {
+
+    flush();
+    for (auto buffer : _buffers) {
+        if (buffer->in_use())
+            buffer->wait();
+        delete buffer;
+    }
+    tally(FftMetrics::SLOTS, -(int64_t) _buffers.size());
+    _buffers.clear();
+
+    // pinned host memory is still mapped, unmap it before the release
+    if (NULL != _staging)
+        clEnqueueUnmapMemObject(_queue, _host_slab, _staging, 0, NULL, NULL);
+    _staging = NULL;
+    for (auto& host : _host_bufs)
+        clEnqueueUnmapMemObject(_queue, host.first, host.second, 0, NULL, NULL);
+    if (NULL != _queue)
+        clFinish(_queue);
+
+    cl_mem* slabs[] = {&_temp_buf, &_slab, &_host_slab};
+    for (auto slab : slabs) {
+        if (NULL != *slab)
+            clReleaseMemObject(*slab);
+        *slab = NULL;
+    }
+
+    for (auto& host : _host_bufs)
+        clReleaseMemObject(host.first);
+    _host_bufs.clear();
+
+    FftKernel** kernels[] = {&_unpack, &_pack, &_chirp_b, &_chirp_pre, &_chirp_mul, &_chirp_post};
+    for (auto kernel : kernels) {
+        delete *kernel;
+        *kernel = NULL;
+    }
+
+    if (NULL != _chirp_forward)
+        clReleaseMemObject(_chirp_forward);
+    if (NULL != _chirp_backward)
+        clReleaseMemObject(_chirp_backward);
+    _chirp_forward  = NULL;
+    _chirp_backward = NULL;
+
+    if (0 != _forward)
+        clfftDestroyPlan(&_forward);
+    if (0 != _backward)
+        clfftDestroyPlan(&_backward);
+    _forward  = 0;
+    _backward = 0;
+
+    // Release OpenCL working objects. 
+    if (NULL != _queue)
+        clReleaseCommandQueue(_queue);
+    if (NULL != _context)
+        clReleaseContext(_context);
+    _queue   = NULL;
+    _context = NULL;
+}
+
+bool FftQueue::transform(FftJob& job, clfftDirection direction) {
+
+    // get buffer
+    FftBuffer* buffer = get_buffer();
+    if (NULL == buffer)
+        return false;
+    buffer->set_job(&job);
+    buffer->_direction = direction;
+    _pending.push_back(buffer);
+
+    // no slot left to merge with
+    if (!has_free_buffer())
+        return flush();
+    return true;
+}
+
+// Enqueue the submitted slots in runs of adjacent slots going the same way
+bool FftQueue::flush() {
+    std::sort(_pending.begin(), _pending.end(), 
+              [](FftBuffer* a, FftBuffer* b) { return a->_index < b->_index; });
+
+    bool ok = true;
+    std::vector<FftBuffer*> run;
+    for (auto buffer : _pending) {
+        if (!run.empty() && (run.back()->_index + 1 != buffer->_index || 
+                             run.back()->_direction != buffer->_direction)) {
+            ok = enqueue(run) && ok;
+            run.clear();
+        }
+        run.push_back(buffer);
+    }
+    if (!run.empty())
+        ok = enqueue(run) && ok;
+
+    _pending.clear();
+    return ok;
+}
+
+bool FftQueue::enqueue(const std::vector<FftBuffer*>& run) {
+    cl_int err = 0;
+    clfftDirection direction = run[0]->_direction;
+    clfftPlanHandle plan = CLFFT_FORWARD == direction ? _forward : _backward;
+
+    std::vector<cl_event> ready(run.size(), (cl_event) 0);
+    std::vector<cl_event> transform(run.size(), (cl_event) 0);
+
+    // Enqueue write of the job data, converting packed data on the device
+    if (!upload(run, ready))
+        return false;
+
+    // Enqueue the FFTs
+    for (size_t i = 0; i < run.size(); ++i) {
+        FftBuffer* buffer = run[i];
+
+        if (_fft.is_bluestein()) {
+            if (!bluestein(buffer, direction, ready[i], &transform[i]))
+                return false;
+        } else {
+            err = clfftEnqueueTransform(plan, direction, 1, &_queue, 1, &ready[i], &transform[i],
+                                         buffer->data_addr(), buffer->output_addr(), buffer->temp());
+            CHECK("clEnqueueTransform");
+            buffer->trace(FftBuffer::TRANSFORM, transform[i], transform[i]);
+        }
+    }
+
+    // Copy results to the jobs
+    if (!download(run, transform))
+        return false;
+
+    for (size_t i = 0; i < run.size(); ++i) {
+        clReleaseEvent(ready[i]);
+        clReleaseEvent(transform[i]);
+    }
+    return true;
+}
+
+void FftQueue::wait_all() {
+    flush();
+    for (auto buffer : _buffers) {
+        if (buffer->in_use())
+            buffer->wait();
+    }
+}
+
+bool FftQueue::has_free_buffer() {
+    for (auto buffer : _buffers) {
+        if (!buffer->in_use())
+            return true;
+    }
+    return false;
+}
+
+// Host memory allocated by this lane's context, so a CPU sub-device gets
+// pages placed by its own runtime rather than wherever the caller runs.
+cl_float* FftQueue::alloc_host(size_t count) {
+    cl_int err = 0;
+
+    cl_mem host = clCreateBuffer(_context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                 count * sizeof(cl_float), NULL, &err);
+    if (CL_SUCCESS != err)
+        return NULL;
+
+    void* data = clEnqueueMapBuffer(_queue, host, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 
+                                    0, count * sizeof(cl_float), 0, NULL, NULL, &err);
+    if (CL_SUCCESS != err) {
+        clReleaseMemObject(host);
+        return NULL;
+    }
+
+    _host_bufs.push_back(std::make_pair(host, data));
+    return (cl_float*) data;
+}
+
+// scratch for whichever plan needs more
+size_t FftQueue::get_temp_buffer_size() {
+    size_t size = 0;
+    for (auto plan : {_forward, _backward}) {
+        size_t plan_size = 0;
+        if (0 != plan && 0 == clfftGetTmpBufSize(plan, &plan_size))
+            size = std::max(size, plan_size);
+    }
+    return size;
+}
+
+// slab bytes per slot, each region aligned for its sub-buffer
+size_t FftQueue::get_slot_bytes() {
+    size_t bytes = 0;
+    for (int region = 0; region < REGIONS; ++region)
+        bytes += align(region_size((Region) region));
+    return bytes;
+}
+
+size_t FftQueue::get_shared_bytes() {
+    size_t bytes = align(get_temp_buffer_size());
+    if (_fft.is_bluestein())
+        bytes += 2 * _fft.get_plan_size() * 2 * sizeof(cl_float);
+    return bytes;
+}
+
+// sub-devices report the memory of the whole device
+size_t FftQueue::get_device_memory() {
+    cl_ulong size = 0;
+    if (CL_SUCCESS != clGetDeviceInfo(_device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(size), &size, NULL))
+        return 0;
+    return size;
+}
+
+bool FftQueue::setup_cl() {
+    cl_int err = 0;
+
+    // Setup context
+    cl_context_properties props[3] = {CL_CONTEXT_PLATFORM, (cl_context_properties) _platform, 0};
+    _context = clCreateContext(props, 1, &_device, NULL, NULL, &err);
+    CHECK("clCreateContext");
+
+    // Setup queues, with timestamps when tracing or timing stages
+    FftTrace* trace = _fft.get_trace();
+    cl_command_queue_properties properties = trace || _fft.get_metrics() ? 
+                                             CL_QUEUE_PROFILING_ENABLE : 0;
+    _queue = clCreateCommandQueue(_context, _device, properties /* IN-ORDER */, &err);
+    CHECK("clCreateCommandQueue");
+
+    if (trace)
+        _trace_offset = trace->calibrate(_queue);
+
+    // sub-buffer origins must be aligned, and the slab is a single allocation
+    cl_uint  align_bits = 0;
+    cl_ulong max_alloc  = 0;
+    err = clGetDeviceInfo(_device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(align_bits), &align_bits, NULL);
+    CHECK("clGetDeviceInfo CL_DEVICE_MEM_BASE_ADDR_ALIGN");
+    err = clGetDeviceInfo(_device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+    CHECK("clGetDeviceInfo CL_DEVICE_MAX_MEM_ALLOC_SIZE");
+    _align     = std::max(align_bits / 8, 1u);
+    _max_alloc = max_alloc;
+
+    return true;
+}
+
+bool FftQueue::setup_plan(clfftPlanHandle* plan, size_t length, clfftLayout in, clfftLayout out) {
+    cl_int err = 0;
+    
+    // Size of FFT 
+    size_t clLengths = length;
+    clfftDim dim = CLFFT_1D;
+    
+    // Create a default plan for a complex FFT 
+    err = clfftCreateDefaultPlan(plan, _context, dim, &clLengths);
+    CHECK("clfftCreateDefaultPlan");
+
+    // Set plan parameters
+    err = clfftSetPlanPrecision(*plan, CLFFT_SINGLE);
+    CHECK("clfftSetPlanPrecision");
+    err = clfftSetLayout(*plan, in, out);
+    CHECK("clfftSetLayout");
+    err = clfftSetResultLocation(*plan, CLFFT_INPLACE);
+    CHECK("clfftSetResultLocation");
+
+    // Bake the plan
+    err = clfftBakePlan(*plan, 1, &_queue, NULL, NULL);
+    CHECK("clfftBakePlan");
+    tally(FftMetrics::PLAN_BAKES);
+
+    return true;
+}
+
+// All channels of an interleaved job in one batch, out of place: real
+// samples stride apart with channels one apart, spectra channel after channel
+bool FftQueue::setup_strided_plan(clfftPlanHandle* plan, size_t length, clfftLayout in, clfftLayout out) {
+    cl_int err = 0;
+
+    size_t clLengths  = length;
+    size_t stride     = _fft.get_stride();
+    size_t bins       = length / 2 + 1;
+    bool   forward    = CLFFT_REAL == in;
+    size_t in_stride  = forward ? stride : 1;
+    size_t out_stride = forward ? 1 : stride;
+
+    err = clfftCreateDefaultPlan(plan, _context, CLFFT_1D, &clLengths);
+    CHECK("clfftCreateDefaultPlan");
+
+    err = clfftSetPlanPrecision(*plan, CLFFT_SINGLE);
+    CHECK("clfftSetPlanPrecision");
+    err = clfftSetLayout(*plan, in, out);
+    CHECK("clfftSetLayout");
+    err = clfftSetResultLocation(*plan, CLFFT_OUTOFPLACE);
+    CHECK("clfftSetResultLocation");
+    err = clfftSetPlanBatchSize(*plan, _fft.get_channels());
+    CHECK("clfftSetPlanBatchSize");
+    err = clfftSetPlanInStride(*plan, CLFFT_1D, &in_stride);
+    CHECK("clfftSetPlanInStride");
+    err = clfftSetPlanOutStride(*plan, CLFFT_1D, &out_stride);
+    CHECK("clfftSetPlanOutStride");
+    err = clfftSetPlanDistance(*plan, forward ? 1 : bins, forward ? bins : 1);
+    CHECK("clfftSetPlanDistance");
+
+    err = clfftBakePlan(*plan, 1, &_queue, NULL, NULL);
+    CHECK("clfftBakePlan");
+    tally(FftMetrics::PLAN_BAKES);
+
+    return true;
+}
+
+bool FftQueue::setup_bluestein() {
+    cl_int err = 0;
+    size_t m = _fft.get_plan_size();
+    FftCache* cache = _fft.get_cache();
+
+    // one program, the cache hands the same binary to every kernel
+    _chirp_b    = new FftKernel(_context, _device, _bluestein_source, "chirp_b");
+    _chirp_pre  = new FftKernel(_context, _device, _bluestein_source, "chirp_pre");
+    _chirp_mul  = new FftKernel(_context, _device, _bluestein_source, "chirp_mul");
+    _chirp_post = new FftKernel(_context, _device, _bluestein_source, "chirp_post");
+    if (!_chirp_b->build("", cache) || !_chirp_pre->build("", cache) || 
+        !_chirp_mul->build("", cache) || !_chirp_post->build("", cache))
+        return false;
+
+    // transformed convolution chirps: conj(c) for forward, c for inverse
+    cl_mem*  spectra[2] = {&_chirp_forward, &_chirp_backward};
+    cl_int   signs[2]   = {1, -1};
+    cl_uint  n          = _fft.get_size();
+    cl_uint  length     = m;
+
+    for (int i = 0; i < 2; ++i) {
+        *spectra[i] = clCreateBuffer(_context, CL_MEM_READ_WRITE, m * 2 * sizeof(cl_float), 
+                                     NULL, &err);
+        CHECK("clCreateBuffer chirp");
+
+        _chirp_b->set_arg(0, *spectra[i]);
+        _chirp_b->set_arg(1, n);
+        _chirp_b->set_arg(2, length);
+        _chirp_b->set_arg(3, signs[i]);
+        err = clEnqueueNDRangeKernel(_queue, _chirp_b->kernel(), 1, NULL, &m, NULL, 0, NULL, NULL);
+        CHECK("clEnqueueNDRangeKernel chirp_b");
+
+        err = clfftEnqueueTransform(_forward, CLFFT_FORWARD, 1, &_queue, 0, NULL, NULL,
+                                    spectra[i], NULL, NULL);
+        CHECK("clfftEnqueueTransform chirp");
+    }
+
+    err = clFinish(_queue);
+    CHECK("clFinish");
+    return true;
+}
+
+bool FftQueue::bluestein(FftBuffer* buffer, clfftDirection direction, cl_event ready, 
+                         cl_event* done) {
+    cl_int err = 0;
+    bool    forward   = CLFFT_FORWARD == direction;
+    cl_uint n         = _fft.get_size();
+    cl_int  sign      = forward ? -1 : 1;
+    cl_int  hermitian = forward ? 0 : 1;
+    size_t  m         = _fft.get_plan_size();
+    size_t  outputs   = forward ? n / 2 + 1 : n;
+    cl_mem  chirp     = buffer->chirp();
+    cl_event pre = 0, convolve = 0, mul = 0, inverse = 0;
+
+    _chirp_pre->set_arg(0, buffer->data());
+    _chirp_pre->set_arg(1, chirp);
+    _chirp_pre->set_arg(2, n);
+    _chirp_pre->set_arg(3, sign);
+    _chirp_pre->set_arg(4, hermitian);
+    err = clEnqueueNDRangeKernel(_queue, _chirp_pre->kernel(), 1, NULL, &m, NULL, 1, &ready, &pre);
+    CHECK("clEnqueueNDRangeKernel chirp_pre");
+
+    err = clfftEnqueueTransform(_forward, CLFFT_FORWARD, 1, &_queue, 1, &pre, &convolve,
+                                &chirp, NULL, buffer->temp());
+    CHECK("clfftEnqueueTransform chirp forward");
+
+    _chirp_mul->set_arg(0, chirp);
+    _chirp_mul->set_arg(1, forward ? _chirp_forward : _chirp_backward);
+    err = clEnqueueNDRangeKernel(_queue, _chirp_mul->kernel(), 1, NULL, &m, NULL, 1, &convolve, &mul);
+    CHECK("clEnqueueNDRangeKernel chirp_mul");
+
+    err = clfftEnqueueTransform(_forward, CLFFT_BACKWARD, 1, &_queue, 1, &mul, &inverse,
+                                &chirp, NULL, buffer->temp());
+    CHECK("clfftEnqueueTransform chirp backward");
+
+    _chirp_post->set_arg(0, chirp);
+    _chirp_post->set_arg(1, buffer->data());
+    _chirp_post->set_arg(2, n);
+    _chirp_post->set_arg(3, sign);
+    _chirp_post->set_arg(4, 1 - hermitian);
+    err = clEnqueueNDRangeKernel(_queue, _chirp_post->kernel(), 1, NULL, &outputs, NULL, 
+                                 1, &inverse, done);
+    CHECK("clEnqueueNDRangeKernel chirp_post");
+
+    buffer->trace(FftBuffer::TRANSFORM, pre, *done);
+
+    clReleaseEvent(pre);
+    clReleaseEvent(convolve);
+    clReleaseEvent(mul);
+    clReleaseEvent(inverse);
+    return true;
+}
+
+bool FftQueue::setup_kernels() {
+    Fft::Transfer transfer = _fft.get_transfer();
+
+    if (Fft::FLOAT != transfer) {
+        const char* source = Fft::HALF == transfer ? _unpack_half_source : _unpack_int16_source;
+        _unpack = new FftKernel(_context, _device, source, "unpack");
+        if (!_unpack->build("", _fft.get_cache()))
+            return false;
+    }
+
+    if (_fft.get_pack_output()) {
+        _pack = new FftKernel(_context, _device, _pack_half_source, "pack");
+        if (!_pack->build("", _fft.get_cache()))
+            return false;
+    }
+
+    return true;
+}
+
+bool FftQueue::setup_buffers(int slots, size_t budget) {
+    cl_int err = 0;
+    size_t slot_bytes = get_slot_bytes();
+    size_t temp_size  = get_temp_buffer_size();
+
+    // as many slots as fit beside the shared allocations, up to the number asked for
+    if (0 != budget) {
+        size_t shared = get_shared_bytes();
+        size_t fit    = budget > shared ? (budget - shared) / get_slot_bytes() : 0;
+        if (0 == fit) {
+            std::cerr << "Error: lane " << _index << " needs " << ((shared + get_slot_bytes()) >> 20)
+                      << " MB for one slot, budget is " << (budget >> 20) << " MB" << std::endl;
+            return false;
+        }
+        slots = std::min((size_t) slots, fit);
+    }
+
+    // and no more than one allocation holds
+    size_t fit_alloc = _max_alloc > align(temp_size) ? (_max_alloc - align(temp_size)) / slot_bytes : 0;
+    if (0 == fit_alloc) {
+        std::cerr << "Error: lane " << _index << " slot of " << (slot_bytes >> 20) 
+                  << " MB exceeds the largest allocation" << std::endl;
+        return false;
+    }
+    slots = std::min((size_t) slots, fit_alloc);
+
+    // every slot's data, then packed staging, then chirp workspace, then scratch
+    size_t offset = 0;
+    for (int region = 0; region < REGIONS; ++region) {
+        _strides[region] = align(region_size((Region) region));
+        _offsets[region] = offset;
+        offset += slots * _strides[region];
+    }
+
+    _slab = clCreateBuffer(_context, CL_MEM_READ_WRITE, offset + temp_size, NULL, &err);
+    CHECK("clCreateBuffer slab");
+
+    if (0 != temp_size) {
+        cl_buffer_region region = {offset, temp_size};
+        _temp_buf = clCreateSubBuffer(_slab, CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, 
+                                      &region, &err);
+        CHECK("clCreateSubBuffer temp");
+    }
+
+    // pinned host mirror of the data region for merged transfers
+    size_t staging = slots * _strides[DATA];
+    _host_slab = clCreateBuffer(_context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, staging, 
+                                NULL, &err);
+    CHECK("clCreateBuffer host slab");
+    _staging = (cl_float*) clEnqueueMapBuffer(_queue, _host_slab, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 
+                                              0, staging, 0, NULL, NULL, &err);
+    CHECK("clEnqueueMapBuffer host slab");
+
+    for (int i = 0; i < slots; ++i) {
+        _buffers.push_back(new FftBuffer(*this, i));
+    }
+    tally(FftMetrics::SLOTS, slots);
+    return true;
+}
+
+size_t FftQueue::region_size(Region region) {
+    switch (region) {
+    case DATA:     return FftBuffer::data_size(_fft);
+    case SPECTRUM: return _fft.is_strided() ? FftBuffer::data_size(_fft) : 0;
+    case PACKED:   return FftBuffer::packed_size(_fft);
+    case CHIRP:    return FftBuffer::chirp_size(_fft);
+    default:       return 0;
+    }
+}
+
+// out of place plans leave the result beside the input
+FftQueue::Region FftQueue::output_region() {
+    return _fft.is_strided() ? SPECTRUM : DATA;
+}
+
+size_t FftQueue::align(size_t bytes) {
+    return (bytes + _align - 1) / _align * _align;
+}
+
+cl_mem FftQueue::sub_buffer(Region region, int slot) {
+    cl_int err = 0;
+    cl_buffer_region range = {_offsets[region] + slot * _strides[region], region_size(region)};
+
+    cl_mem buffer = clCreateSubBuffer(_slab, CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, 
+                                      &range, &err);
+    if (CL_SUCCESS != err) {
+        std::cerr << __FILE__ << ":" << __LINE__ << " Unexpected result for clCreateSubBuffer" 
+                  << " (" << err << ")" << std::endl;
+        return NULL;
+    }
+    return buffer;
+}
+
+cl_float* FftQueue::staging(int slot) {
+    return _staging + slot * _strides[DATA] / sizeof(cl_float);
+}
+
+// A free slot, or when all are in flight the oldest once it completes
+FftBuffer* FftQueue::get_buffer() {
+    FftBuffer* oldest = NULL;
+
+    for (auto buffer : _buffers) {
+        if (buffer->in_use()) {
+            if (NULL == oldest || buffer->_sequence < oldest->_sequence)
+                oldest = buffer;
+            continue;
+        }
+        oldest = buffer;
+        break;
+    }
+
+    if (NULL == oldest)
+        return NULL;
+    if (!_pending.empty() && oldest->in_use())
+        flush();
+    if (oldest->in_use()) {
+        int64_t blocked = FftMetrics::now();
+        oldest->wait();
+        tally(FftMetrics::BUFFER_WAITS);
+        tally(FftMetrics::BLOCKED_NS, FftMetrics::now() - blocked);
+    }
+
+    oldest->set_in_use(true);
+    oldest->_sequence  = _issued++;
+    oldest->_submitted = FftMetrics::now();
+    tally(FftMetrics::SLOTS_BUSY);
+    return oldest;
+}
+
+void FftQueue::tally(FftMetrics::Counter counter, int64_t value) {
+    FftMetrics* metrics = _fft.get_metrics();
+    if (NULL != metrics)
+        metrics->add(counter, value);
+}
+
+// Float input of adjacent slots goes through the host slab in one write;
+// the gaps between slots are written too, the transforms ignore them
+bool FftQueue::upload(const std::vector<FftBuffer*>& run, std::vector<cl_event>& ready) {
+    cl_int err = 0;
+    clfftDirection direction = run[0]->_direction;
+
+    if (1 == run.size() || Fft::FLOAT != _fft.get_transfer()) {
+        for (size_t i = 0; i < run.size(); ++i) {
+            if (!upload(run[i], direction, &ready[i]))
+                return false;
+        }
+        return true;
+    }
+
+    // padded input is zero filled on the host instead of the device
+    size_t count  = _fft.get_input_count(direction);
+    size_t length = CLFFT_FORWARD == direction && _fft.is_padded() ? 
+                    _fft.get_plan_size() * _fft.get_stride() : count;
+    {
+        FftTrace::Span span(_fft.get_trace(), "stage");
+        for (auto buffer : run) {
+            cl_float* staged = staging(buffer->_index);
+            memcpy(staged, buffer->job_data(), count * sizeof(cl_float));
+            memset(staged + count, 0, (length - count) * sizeof(cl_float));
+        }
+    }
+
+    int    first  = run.front()->_index;
+    size_t offset = _offsets[DATA] + first * _strides[DATA];
+    size_t bytes  = (run.size() - 1) * _strides[DATA] + length * sizeof(cl_float);
+
+    cl_event write = 0;
+    err = clEnqueueWriteBuffer(_queue, _slab, CL_FALSE, offset, bytes, staging(first), 
+                                0, NULL, &write);
+    CHECK("clEnqueueWriteBuffer merged");
+    tally(FftMetrics::BYTES_UP, bytes);
+
+    for (size_t i = 0; i < run.size(); ++i) {
+        run[i]->trace(FftBuffer::WRITE, write, write);
+        if (0 != i)
+            clRetainEvent(write);
+        ready[i] = write;
+    }
+    return true;
+}
+
+// Float results of adjacent slots come back in one read once all are done
+bool FftQueue::download(const std::vector<FftBuffer*>& run, std::vector<cl_event>& transforms) {
+    cl_int err = 0;
+    clfftDirection direction = run[0]->_direction;
+
+    if (1 == run.size() || _fft.get_pack_output()) {
+        for (size_t i = 0; i < run.size(); ++i) {
+            cl_event read = 0;
+            if (!download(run[i], transforms[i], direction, &read))
+                return false;
+            run[i]->set_wait(read);
+        }
+        return true;
+    }
+
+    size_t count  = _fft.get_output_count(direction);
+    int    first  = run.front()->_index;
+    Region region = output_region();
+    size_t offset = _offsets[region] + first * _strides[region];
+    size_t bytes  = (run.size() - 1) * _strides[region] + count * sizeof(cl_float);
+
+    cl_event read = 0;
+    err = clEnqueueReadBuffer(_queue, _slab, CL_FALSE, offset, bytes, staging(first), 
+                               transforms.size(), transforms.data(), &read);
+    CHECK("clEnqueueReadBuffer merged");
+    tally(FftMetrics::BYTES_DOWN, bytes);
+
+    for (size_t i = 0; i < run.size(); ++i) {
+        run[i]->trace(FftBuffer::READ, read, read);
+        run[i]->set_unpack(0, 0);
+        run[i]->set_staged(count);
+        if (0 != i)
+            clRetainEvent(read);
+        run[i]->set_wait(read);
+    }
+    return true;
+}
+
+bool FftQueue::upload(FftBuffer* buffer, clfftDirection direction, cl_event* ready) {
+    cl_int err = 0;
+    Fft::Transfer transfer = _fft.get_transfer();
+    size_t   count = _fft.get_input_count(direction);
+    cl_event fill  = 0;
+
+    // zero the tail of a padded input, the queue is in order
+    if (CLFFT_FORWARD == direction && _fft.is_padded()) {
+        cl_float zero = 0;
+        size_t   pad  = _fft.get_plan_size() * _fft.get_stride() - count;
+        err = clEnqueueFillBuffer(_queue, buffer->data(), &zero, sizeof(zero), 
+                                  count * sizeof(cl_float), pad * sizeof(cl_float), 0, NULL, &fill);
+        CHECK("clEnqueueFillBuffer");
+    }
+
+    if (Fft::FLOAT == transfer) {
+        err = clEnqueueWriteBuffer(_queue, buffer->data(), CL_FALSE, 0, 
+                                    count * sizeof(cl_float), buffer->job_data(), 0, NULL, ready);
+        CHECK("clEnqueueWriteBuffer");
+        tally(FftMetrics::BYTES_UP, count * sizeof(cl_float));
+        buffer->trace(FftBuffer::WRITE, fill ? fill : *ready, *ready);
+        if (fill)
+            clReleaseEvent(fill);
+        return true;
+    }
+
+    // pack on the host, widen to float on the device
+    cl_event write = 0;
+    cl_float scale = 1;
+
+    {
+        FftTrace::Span span(_fft.get_trace(), "pack");
+        if (Fft::HALF == transfer) {
+            // a spectrum's DC bin is about mean * N, past half range at large N;
+            // normalize as the packed output does, the unpack kernel undoes it
+            float norm = CLFFT_BACKWARD == direction ? 1.0f / _fft.get_size() : 1.0f;
+            pack_half(buffer->job_data(), buffer->packed(), count, norm);
+            scale = 1.0f / norm;
+        } else
+            scale = pack_int16(buffer->job_data(), (cl_short*) buffer->packed(), count);
+    }
+
+    err = clEnqueueWriteBuffer(_queue, buffer->packed_data(), CL_FALSE, 0,
+                                count * sizeof(cl_half), buffer->packed(), 0, NULL, &write);
+    CHECK("clEnqueueWriteBuffer packed");
+    tally(FftMetrics::BYTES_UP, count * sizeof(cl_half));
+
+    _unpack->set_arg(0, buffer->packed_data());
+    _unpack->set_arg(1, buffer->data());
+    _unpack->set_arg(2, scale);
+    err = clEnqueueNDRangeKernel(_queue, _unpack->kernel(), 1, NULL, &count, NULL, 
+                                 1, &write, ready);
+    CHECK("clEnqueueNDRangeKernel unpack");
+    buffer->trace(FftBuffer::WRITE, fill ? fill : write, *ready);
+
+    if (fill)
+        clReleaseEvent(fill);
+    clReleaseEvent(write);
+    return true;
+}
+
+bool FftQueue::download(FftBuffer* buffer, cl_event transform, clfftDirection direction, 
+                        cl_event* read) {
+    cl_int err = 0;
+    size_t count = _fft.get_output_count(direction);
+
+    if (!_fft.get_pack_output()) {
+        err = clEnqueueReadBuffer(_queue, buffer->output(), CL_FALSE, 0,
+                                   count * sizeof(cl_float), buffer->job_data(), 1, &transform, read);
+        CHECK("clEnqueueReadBuffer");
+        tally(FftMetrics::BYTES_DOWN, count * sizeof(cl_float));
+        buffer->trace(FftBuffer::READ, *read, *read);
+        buffer->set_unpack(0, 0);
+        buffer->set_staged(0);
+        return true;
+    }
+
+    // normalize spectra so the DC bin stays in half range, undone on unpack
+    cl_event pack  = 0;
+    cl_float scale = CLFFT_FORWARD == direction ? 1.0f / _fft.get_size() : 1.0f;
+
+    _pack->set_arg(0, buffer->output());
+    _pack->set_arg(1, buffer->packed_data());
+    _pack->set_arg(2, scale);
+    err = clEnqueueNDRangeKernel(_queue, _pack->kernel(), 1, NULL, &count, NULL, 
+                                 1, &transform, &pack);
+    CHECK("clEnqueueNDRangeKernel pack");
+
+    err = clEnqueueReadBuffer(_queue, buffer->packed_data(), CL_FALSE, 0,
+                               count * sizeof(cl_half), buffer->packed(), 1, &pack, read);
+    CHECK("clEnqueueReadBuffer packed");
+    tally(FftMetrics::BYTES_DOWN, count * sizeof(cl_half));
+    buffer->trace(FftBuffer::READ, pack, *read);
+    buffer->set_unpack(count, 1.0f / scale);
+    buffer->set_staged(0);
+
+    clReleaseEvent(pack);
+    return true;
+}
@@ -0,0 +1,130 @@
+#ifndef __FftQueue_hh
+#define __FftQueue_hh
+
+#include <clFFT.h>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "fftjob.hh"
+#include "fftbuffer.hh"
+#include "fftkernel.hh"
+#include "fftmetrics.hh"
+
+class Fft;
+
+// One execution lane of an Fft: a device (or sub-device) with its own
+// context, in-order queue, baked plans and buffer slots.
+//
+// The slots' device memory is one slab of sub-buffers, each region type
+// laid out slot after slot, with a pinned host slab mirroring the data
+// region. Submitted transforms are enqueued on flush(), when the slots
+// run out or on wait; adjacent slots going the same way then share one
+// write and one read through the host slab.
+
+class FftQueue {
+
+friend class Fft;
+
+public:
+    enum Region {DATA, SPECTRUM, PACKED, CHIRP, REGIONS};
+
+public:
+    FftQueue(Fft& fft, int index, cl_platform_id platform, cl_device_id device);
+    ~FftQueue();
+
+    // slots is the most wanted; budget, if not 0, is the device bytes the
+    // lane may use and can lower it
+    bool        init(int slots, size_t budget = 0);
+    void        shutdown();
+
+    bool        transform(FftJob& job, clfftDirection direction);
+    bool        flush();
+    void        wait_all();
+
+    bool        has_free_buffer();
+    cl_float*   alloc_host(size_t count);
+
+public:
+    Fft&                get_fft()       { return _fft; }
+    int                 get_index()     { return _index; }
+    cl_context          get_context()   { return _context; }
+    cl_device_id        get_device()    { return _device; }
+    cl_command_queue    get_queue()     { return _queue; }
+    size_t              get_temp_buffer_size();
+    cl_mem              get_temp()      { return _temp_buf; }
+
+    // device memory: per slot, shared by the slots, and the device total
+    int                 get_slots()     { return _buffers.size(); }
+    size_t              get_slot_bytes();
+    size_t              get_shared_bytes();
+    size_t              get_device_memory();
+    int64_t             get_trace_offset() { return _trace_offset; }
+
+    cl_mem              sub_buffer(Region region, int slot);
+    cl_float*           staging(int slot);
+
+private:
+    bool setup_cl();
+    bool setup_plan(clfftPlanHandle* plan, size_t length, clfftLayout in, clfftLayout out);
+    bool setup_strided_plan(clfftPlanHandle* plan, size_t length, clfftLayout in, clfftLayout out);
+    bool setup_bluestein();
+    bool setup_kernels();
+    bool setup_buffers(int slots, size_t budget);
+
+    FftBuffer*  get_buffer();
+    void        tally(FftMetrics::Counter counter, int64_t value = 1);
+    size_t      region_size(Region region);
+    Region      output_region();
+    size_t      align(size_t bytes);
+
+    bool enqueue(const std::vector<FftBuffer*>& run);
+    bool upload(const std::vector<FftBuffer*>& run, std::vector<cl_event>& ready);
+    bool download(const std::vector<FftBuffer*>& run, std::vector<cl_event>& transforms);
+    bool upload(FftBuffer* buffer, clfftDirection direction, cl_event* ready);
+    bool bluestein(FftBuffer* buffer, clfftDirection direction, cl_event ready, 
+                   cl_event* done);
+    bool download(FftBuffer* buffer, cl_event transform, clfftDirection direction, 
+                  cl_event* read);
+
+private:
+    Fft&                    _fft;
+    int                     _index;
+
+    cl_platform_id          _platform;
+    cl_device_id            _device;
+    cl_context              _context;
+    cl_command_queue        _queue;
+    clfftPlanHandle         _forward;
+    clfftPlanHandle         _backward;
+    FftKernel*              _unpack;
+    FftKernel*              _pack;
+
+    // Bluestein chirp kernels and the transformed convolution chirps
+    FftKernel*              _chirp_b;
+    FftKernel*              _chirp_pre;
+    FftKernel*              _chirp_mul;
+    FftKernel*              _chirp_post;
+    cl_mem                  _chirp_forward;
+    cl_mem                  _chirp_backward;
+
+    // slot memory, and clFFT scratch shared as the queue runs one transform at a time
+    cl_mem                  _slab;
+    cl_mem                  _host_slab;
+    cl_float*               _staging;
+    cl_mem                  _temp_buf;
+    size_t                  _offsets[REGIONS];
+    size_t                  _strides[REGIONS];
+    size_t                  _align;
+    size_t                  _max_alloc;
+
+    std::vector<FftBuffer*> _buffers;
+    std::vector<FftBuffer*> _pending;
+    uint64_t                _issued;
+    std::vector<std::pair<cl_mem, void*>> _host_bufs;   // with their mappings
+
+    // device profiling clock to trace clock
+    int64_t                 _trace_offset;
+};
+
+#endif // __FftQueue_hh
@@ -0,0 +1,424 @@
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "fftserver.hh"
+
+volatile bool FftServer::_stop = false;
+
+FftServer::FftServer(const std::string& path, Fft::Device device, int parallel,
+                     Configure configure)
+  : _path(path),
+    _device(device),
+    _parallel(parallel),
+    _configure(configure),
+    _listen(-1)
+{
+}
+
+FftServer::~FftServer() {
+    shutdown();
+}
+
+void FftServer::stop() {
+    _stop = true;
+}
+
+// Only warmed sizes are served: baking on demand would stall the loop for
+// every client and let one of them fill device memory with plans
+bool FftServer::warm(size_t size) {
+
+    if (NULL != get_fft(size))
+        return true;
+
+    Fft* fft = new Fft(size, _device, _parallel);
+    if (NULL != _configure)
+        _configure(*fft);
+    if (!fft->init()) {
+        fft->shutdown();
+        delete fft;
+        return false;
+    }
+
+    _ffts[size] = fft;
+    _pending[fft] = 0;
+    return true;
+}
+
+bool FftServer::run() {
+
+    if (!listen_socket())
+        return false;
+
+    std::vector<pollfd>   fds;
+    std::vector<Inflight> inflight;
+
+    while (!_stop) {
+        fds.clear();
+        fds.push_back({_listen, POLLIN, 0});
+        for (auto client : _clients) {
+            short events = POLLIN | (client->output.empty() ? 0 : POLLOUT);
+            fds.push_back({client->fd, events, 0});
+        }
+
+        int ready = poll(fds.data(), fds.size(), 500);
+        if (ready < 0) {
+            if (EINTR == errno)
+                continue;
+            std::cerr << "poll: " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (0 == ready)
+            continue;
+
+        // submit everything that arrived, then answer once it has landed
+        std::vector<Client*> closed;
+        for (size_t i = 1; i < fds.size(); ++i) {
+            if (0 == fds[i].revents)
+                continue;
+            Client* client = _clients[i - 1];
+            if (fds[i].revents & POLLOUT)
+                flush(client);
+            if ((fds[i].revents & ~POLLOUT) && !read_requests(client, inflight))
+                closed.push_back(client);
+        }
+
+        drain(inflight);
+
+        // and those that stopped reading their answers, once nothing is in flight
+        for (auto client : _clients) {
+            if (client->dead && closed.end() == std::find(closed.begin(), closed.end(), client))
+                closed.push_back(client);
+        }
+        for (auto client : closed)
+            disconnect(client);
+
+        if (fds[0].revents & POLLIN)
+            accept_client();
+    }
+
+    return true;
+}
+
+void FftServer::shutdown() {
+
+    while (!_clients.empty())
+        disconnect(_clients.back());
+
+    if (0 <= _listen) {
+        close(_listen);
+        unlink(_path.c_str());
+        _listen = -1;
+    }
+
+    for (auto& entry : _ffts) {
+        entry.second->shutdown();
+        delete entry.second;
+    }
+    _ffts.clear();
+    _pending.clear();
+}
+
+bool FftServer::listen_socket() {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (sizeof(addr.sun_path) <= _path.size()) {
+        std::cerr << "Socket path too long: " << _path << std::endl;
+        return false;
+    }
+    strncpy(addr.sun_path, _path.c_str(), sizeof(addr.sun_path) - 1);
+
+    _listen = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(_path.c_str());
+
+    if (_listen < 0 ||
+        0 != bind(_listen, (sockaddr*) &addr, sizeof(addr)) ||
+        0 != listen(_listen, 16)) {
+        std::cerr << "Unable to listen on " << _path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void FftServer::accept_client() {
+    int fd = accept(_listen, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    // replies are queued, a client that stops reading never blocks the loop
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    Client* client = new Client();
+    client->fd = fd;
+    client->dead = false;
+    client->region = NULL;
+    client->region_bytes = 0;
+    client->slots = 0;
+    client->slot_size = 0;
+    _clients.push_back(client);
+}
+
+bool FftServer::read_requests(Client* client, std::vector<Inflight>& inflight) {
+    char buffer[64 * sizeof(FftRequest)];
+    char control[CMSG_SPACE(4 * sizeof(int))];
+
+    iovec  io  = {buffer, sizeof(buffer)};
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &io;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t count = recvmsg(client->fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (count < 0)
+        return EAGAIN == errno || EINTR == errno;
+    if (0 == count)
+        return false;
+
+    // descriptors ride with the ATTACH that follows them in the stream
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); NULL != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type)
+            continue;
+        size_t fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < fds; ++i) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            client->fds.push_back(fd);
+        }
+    }
+
+    client->input.append(buffer, count);
+
+    size_t offset = 0;
+    for (; offset + sizeof(FftRequest) <= client->input.size(); offset += sizeof(FftRequest)) {
+        FftRequest request;
+        memcpy(&request, client->input.data() + offset, sizeof(request));
+
+        switch (request.op) {
+        case FftRequest::ATTACH:
+            respond(client, request, attach(client, request, inflight) ? 
+                    FftResponse::OK : FftResponse::BAD_REQUEST);
+            break;
+        case FftRequest::DETACH:
+            // let queued work on the slots finish first
+            drain(inflight);
+            detach(client);
+            respond(client, request, FftResponse::OK);
+            break;
+        case FftRequest::FORWARD:
+        case FftRequest::BACKWARD:
+            submit(client, request, inflight);
+            break;
+        case FftRequest::CAPACITY: {
+            Fft* fft = get_fft(request.size);
+            if (NULL == fft)
+                respond(client, request, FftResponse::BAD_REQUEST);
+            else
+                respond(client, request, FftResponse::OK, fft->get_job_capacity());
+            break;
+        }
+        default:
+            respond(client, request, FftResponse::BAD_REQUEST);
+            break;
+        }
+    }
+    client->input.erase(0, offset);
+
+    return true;
+}
+
+bool FftServer::attach(Client* client, const FftRequest& request, 
+                       std::vector<Inflight>& inflight) {
+    char name[FFT_SERVICE_NAME + 1];
+    memcpy(name, request.name, FFT_SERVICE_NAME);
+    name[FFT_SERVICE_NAME] = 0;
+
+    // a previous region may still have transforms writing into it
+    if (NULL != client->region) {
+        drain(inflight);
+        detach(client);
+    }
+
+    if (client->fds.empty()) {
+        std::cerr << "ATTACH " << name << " without a memfd" << std::endl;
+        return false;
+    }
+    int fd = client->fds.front();
+    client->fds.erase(client->fds.begin());
+
+    // the client keeps its own mapping; sealed against shrinking, it cannot
+    // truncate pages the transforms still read and write
+    struct stat st;
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || 0 == (seals & F_SEAL_SHRINK) || 0 != fstat(fd, &st)) {
+        std::cerr << "ATTACH " << name << ": memfd not sealed against shrinking" << std::endl;
+        close(fd);
+        return false;
+    }
+
+    void* region = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == region)
+        return false;
+
+    // read the header once, and check its product without overflowing
+    FftSlotArray* header = (FftSlotArray*) region;
+    size_t   slots  = 0;
+    size_t   slot_size = 0;
+    if ((size_t) st.st_size >= sizeof(FftSlotArray)) {
+        slots     = header->slots;
+        slot_size = header->slot_size;
+    }
+    size_t floats = ((size_t) st.st_size - sizeof(FftSlotArray)) / sizeof(float);
+    if ((size_t) st.st_size < sizeof(FftSlotArray) || 
+        FFT_SERVICE_MAGIC != header->magic ||
+        0 == slots || 0 == slot_size || floats / slots < slot_size) {
+        munmap(region, st.st_size);
+        return false;
+    }
+
+    client->region = region;
+    client->region_bytes = st.st_size;
+    client->slots = slots;
+    client->slot_size = slot_size;
+    return true;
+}
+
+void FftServer::detach(Client* client) {
+    if (NULL != client->region) {
+        munmap(client->region, client->region_bytes);
+        client->region = NULL;
+        client->region_bytes = 0;
+        client->slots = 0;
+        client->slot_size = 0;
+    }
+}
+
+void FftServer::disconnect(Client* client) {
+    detach(client);
+    for (auto fd : client->fds)
+        close(fd);
+    close(client->fd);
+    _clients.erase(std::remove(_clients.begin(), _clients.end(), client), _clients.end());
+    delete client;
+}
+
+bool FftServer::submit(Client* client, const FftRequest& request, 
+                       std::vector<Inflight>& inflight) {
+
+    if (NULL == client->region)
+        return respond(client, request, FftResponse::NOT_ATTACHED);
+
+    // only the layout copied at ATTACH, never the client-writable header
+    if (client->slots <= request.slot || 0 == request.size)
+        return respond(client, request, FftResponse::BAD_REQUEST);
+
+    Fft* fft = get_fft(request.size);
+    if (NULL == fft)
+        return respond(client, request, FftResponse::BAD_REQUEST);
+
+    // the slot must hold the whole in-place result, inside the mapping
+    size_t bytes = fft->get_job_capacity() * sizeof(float);
+    size_t data  = client->region_bytes - sizeof(FftSlotArray);
+    if (client->slot_size < fft->get_job_capacity() ||
+        request.slot * client->slot_size * sizeof(float) + bytes > data)
+        return respond(client, request, FftResponse::BAD_REQUEST);
+
+    // every buffer slot of this size is busy - drain it first
+    if (_parallel <= _pending[fft])
+        complete(fft, inflight);
+
+    // the job wraps the shared memory, the transform reads and writes it directly
+    float*  slot = (float*) ((FftSlotArray*) client->region + 1) + request.slot * client->slot_size;
+    FftJob* job  = new FftJob(slot, request.size, client->slot_size);
+    bool ok = FftRequest::FORWARD == request.op ? fft->forward(*job) : fft->backward(*job);
+    if (!ok) {
+        delete job;
+        return respond(client, request, FftResponse::FAILED);
+    }
+
+    inflight.push_back({client, request, job, fft});
+    ++_pending[fft];
+    return true;
+}
+
+void FftServer::complete(Fft* fft, std::vector<Inflight>& inflight) {
+
+    fft->wait_all();
+    _pending[fft] = 0;
+
+    auto done = std::stable_partition(inflight.begin(), inflight.end(), 
+                    [=](const Inflight& entry) { return entry.fft != fft; });
+
+    for (auto it = done; it != inflight.end(); ++it) {
+        respond(it->client, it->request, FftResponse::OK);
+        delete it->job;
+    }
+    inflight.erase(done, inflight.end());
+}
+
+// finish the work of every size, before a region it may touch goes away
+void FftServer::drain(std::vector<Inflight>& inflight) {
+    for (auto& pending : _pending) {
+        if (0 < pending.second)
+            complete(pending.first, inflight);
+    }
+}
+
+bool FftServer::respond(Client* client, const FftRequest& request, uint32_t status,
+                        size_t capacity) {
+    FftResponse response;
+    response.status   = status;
+    response.slot     = request.slot;
+    response.tag      = request.tag;
+    response.capacity = capacity;
+
+    if (client->dead)
+        return false;
+
+    client->output.append((const char*) &response, sizeof(response));
+    flush(client);
+    if (MAX_BACKLOG < client->output.size()) {
+        std::cerr << "Dropping client " << client->fd << ": " << client->output.size() 
+                  << " bytes of responses unread" << std::endl;
+        client->dead = true;
+    }
+
+    return !client->dead;
+}
+
+// as much of the queued responses as the socket takes now
+void FftServer::flush(Client* client) {
+    size_t sent = 0;
+    while (sent < client->output.size()) {
+        ssize_t count = send(client->fd, client->output.data() + sent, 
+                             client->output.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (count < 0) {
+            if (EINTR == errno)
+                continue;
+            if (EAGAIN != errno && EWOULDBLOCK != errno)
+                client->dead = true;
+            break;
+        }
+        sent += count;
+    }
+    client->output.erase(0, sent);
+}
+
+Fft* FftServer::get_fft(size_t size) {
+    auto found = _ffts.find(size);
+    return _ffts.end() == found ? NULL : found->second;
+}
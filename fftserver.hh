@@ -0,0 +1,86 @@
+#ifndef __FftServer_hh
+#define __FftServer_hh
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "fft.hh"
+#include "fftservice.hh"
+
+// Long running FFT service. Keeps one initialized Fft per transform size so
+// clients skip context creation and plan baking, and transforms sample data
+// in the clients' shared-memory slot arrays (see fftservice.hh). The sizes are
+// fixed at startup by warm(); requests for any other are refused.
+
+class FftServer {
+
+public:
+    typedef void (*Configure)(Fft& fft);
+
+public:
+    FftServer(const std::string& path, Fft::Device device, int parallel, 
+              Configure configure);
+    ~FftServer();
+
+    bool        warm(size_t size);
+    bool        run();
+    void        shutdown();
+
+    static void stop();
+
+private:
+    struct Client {
+        int                     fd;
+        void*                   region;
+        size_t                  region_bytes;
+        size_t                  slots;          // the header as of ATTACH, the
+        size_t                  slot_size;      // client can rewrite it later
+        std::string             input;
+        std::vector<int>        fds;            // received with the input, for ATTACH
+        std::string             output;         // responses the socket has not taken
+        bool                    dead;           // stopped reading, dropped next round
+    };
+
+    struct Inflight {
+        Client*                 client;
+        FftRequest              request;
+        FftJob*                 job;
+        Fft*                    fft;
+    };
+
+    bool        listen_socket();
+    void        accept_client();
+    bool        read_requests(Client* client, std::vector<Inflight>& inflight);
+
+    bool        attach(Client* client, const FftRequest& request, 
+                       std::vector<Inflight>& inflight);
+    void        detach(Client* client);
+    void        disconnect(Client* client);
+
+    bool        submit(Client* client, const FftRequest& request, 
+                       std::vector<Inflight>& inflight);
+    void        complete(Fft* fft, std::vector<Inflight>& inflight);
+    void        drain(std::vector<Inflight>& inflight);
+    bool        respond(Client* client, const FftRequest& request, uint32_t status,
+                        size_t capacity = 0);
+    void        flush(Client* client);
+
+    Fft*        get_fft(size_t size);
+
+private:
+    std::string             _path;
+    Fft::Device             _device;
+    int                     _parallel;
+    Configure               _configure;
+
+    int                     _listen;
+    std::vector<Client*>    _clients;
+    std::map<size_t, Fft*>  _ffts;
+    std::map<Fft*, int>     _pending;
+
+    static volatile bool    _stop;
+    static const size_t     MAX_BACKLOG = 4096 * sizeof(FftResponse);
+};
+
+#endif // __FftServer_hh
@@ -0,0 +1,58 @@
+#ifndef __FftService_hh
+#define __FftService_hh
+
+#include <cstddef>
+#include <cstdint>
+
+// Wire format between FftServer and FftClient.
+//
+// Sample data never travels over the socket. The client creates a memfd
+// holding an FftSlotArray header followed by `slots` slots of `slot_size`
+// floats, seals it against shrinking, passes the descriptor with ATTACH as
+// SCM_RIGHTS, and then sends FORWARD/BACKWARD requests naming a slot. The
+// server transforms the slot in place and answers with an FftResponse once
+// the result is in shared memory. The shared region is a plain slot array;
+// every request and response still goes over the socket.
+// CAPACITY, allowed before ATTACH, asks how many floats a slot needs for a
+// size under the server's policy, padded lengths need more than N + 2.
+// Sizes the server was not started with are answered BAD_REQUEST.
+
+#define FFT_SERVICE_MAGIC   0x43464654      // "CFFT"
+#define FFT_SERVICE_NAME    64
+#define FFT_SERVICE_SOCKET  "/tmp/clfft-test.sock"
+
+struct FftSlotArray {
+    uint32_t    magic;
+    uint32_t    slots;
+    uint64_t    slot_size;                  // floats per slot
+};
+
+struct FftRequest {
+    enum Op     {ATTACH, FORWARD, BACKWARD, DETACH, CAPACITY};
+
+    uint32_t    op;
+    uint32_t    slot;
+    uint64_t    size;                       // FFT size for FORWARD/BACKWARD/CAPACITY
+    uint64_t    tag;                        // echoed in the response
+    char        name[FFT_SERVICE_NAME];     // memfd name for ATTACH, messages only
+};
+
+struct FftResponse {
+    enum Status {OK, BAD_REQUEST, NOT_ATTACHED, FAILED};
+
+    uint32_t    status;
+    uint32_t    slot;
+    uint64_t    tag;
+    uint64_t    capacity;                   // slot floats, answering CAPACITY
+};
+
+inline size_t fft_slots_bytes(size_t slots, size_t slot_size) {
+    return sizeof(FftSlotArray) + slots * slot_size * sizeof(float);
+}
+
+inline float* fft_slot(void* region, size_t slot) {
+    FftSlotArray* header = (FftSlotArray*) region;
+    return (float*) (header + 1) + slot * header->slot_size;
+}
+
+#endif // __FftService_hh
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+
+#include "fft.hh"
+#include "fftsliding.hh"
+
+#define CHECK(MSG)                              \
+    if (err != CL_SUCCESS) {                    \
+      std::cerr << __FILE__ << ":" << __LINE__  \
+          << " Unexpected result for " << MSG   \
+          << " (" << err << ")" << std::endl;   \
+      return false;                             \
+    }
+
+// One work item per bin walks the hop; ring[head + h] is the sample leaving.
+static const char* _slide_source =
+"__kernel void slide(__global float2* spectrum, __global const float* ring,  \n"
+"                    __global const float* hop, uint n, uint head, uint count)\n"
+"{                                                                          \n"
+"    size_t k = get_global_id(0);                                           \n"
+"    float  c;                                                              \n"
+"    float  s = sincos(2.0f * M_PI_F * ((float) k / (float) n), &c);        \n"
+"    float2 x = spectrum[k];                                                \n"
+"    for (uint h = 0; h < count; ++h) {                                     \n"
+"        x.x += hop[h] - ring[(head + h) % n];                              \n"
+"        x = (float2)(x.x * c - x.y * s, x.x * s + x.y * c);                \n"
+"    }                                                                      \n"
+"    spectrum[k] = x;                                                       \n"
+"}                                                                          \n";
+
+static const char* _insert_source =
+"__kernel void insert(__global float* ring, __global const float* hop,      \n"
+"                     uint n, uint head)                                    \n"
+"{                                                                          \n"
+"    size_t h = get_global_id(0);                                           \n"
+"    ring[(head + h) % n] = hop[h];                                         \n"
+"}                                                                          \n";
+
+static const char* _linearize_source =
+"__kernel void linearize(__global float* window, __global const float* ring,\n"
+"                        uint n, uint head)                                 \n"
+"{                                                                          \n"
+"    size_t i = get_global_id(0);                                           \n"
+"    window[i] = ring[(head + i) % n];                                      \n"
+"}                                                                          \n";
+
+FftSliding::FftSliding(Fft& fft, size_t hop, int refresh)
+  : _fft(fft),
+    _size(fft.get_size()),
+    _hop(hop),
+    _refresh(refresh),
+    _updates(0),
+    _head(0),
+    _ring(NULL),
+    _window(NULL),
+    _hop_buf(NULL),
+    _spectrum(NULL),
+    _exact_buf(NULL),
+    _plan(0),
+    _slide(fft.get_context(), fft.get_device(), _slide_source, "slide"),
+    _insert(fft.get_context(), fft.get_device(), _insert_source, "insert"),
+    _linearize(fft.get_context(), fft.get_device(), _linearize_source, "linearize"),
+    _exact(2 * (_size / 2 + 1), 0, 0),
+    _approx(2 * (_size / 2 + 1), 0, 0),
+    _drift(0),
+    _worst_drift(INFINITY)
+{
+}
+
+FftSliding::~FftSliding() {
+    release();
+}
+
+bool FftSliding::init() {
+    cl_int err = 0;
+    cl_context context = _fft.get_context();
+    cl_command_queue queue = _fft.get_queue();
+    size_t spectrum_bytes = get_bins() * 2 * sizeof(cl_float);
+    cl_float zero = 0;
+
+    // the bins are those of an N point transform, padding would change them
+    if (!Fft::is_fast_size(_size)) {
+        std::cerr << "Sliding window " << _size 
+                  << " must be a product of 2, 3, 5 and 7" << std::endl;
+        return false;
+    }
+
+    if (!_slide.build("", _fft.get_cache()) ||
+        !_insert.build("", _fft.get_cache()) ||
+        !_linearize.build("", _fft.get_cache()))
+        return false;
+
+    _ring = clCreateBuffer(context, CL_MEM_READ_WRITE, _size * sizeof(cl_float), NULL, &err);
+    CHECK("clCreateBuffer ring");
+    _window = clCreateBuffer(context, CL_MEM_READ_WRITE, _size * sizeof(cl_float), NULL, &err);
+    CHECK("clCreateBuffer window");
+    _hop_buf = clCreateBuffer(context, CL_MEM_READ_ONLY, _hop * sizeof(cl_float), NULL, &err);
+    CHECK("clCreateBuffer hop");
+    _spectrum = clCreateBuffer(context, CL_MEM_READ_WRITE, spectrum_bytes, NULL, &err);
+    CHECK("clCreateBuffer spectrum");
+    _exact_buf = clCreateBuffer(context, CL_MEM_READ_WRITE, spectrum_bytes, NULL, &err);
+    CHECK("clCreateBuffer exact");
+
+    // an all zero window has an all zero spectrum
+    err = clEnqueueFillBuffer(queue, _ring, &zero, sizeof(zero), 0, 
+                              _size * sizeof(cl_float), 0, NULL, NULL);
+    CHECK("clEnqueueFillBuffer ring");
+    err = clEnqueueFillBuffer(queue, _spectrum, &zero, sizeof(zero), 0, 
+                              spectrum_bytes, 0, NULL, NULL);
+    CHECK("clEnqueueFillBuffer spectrum");
+
+    return setup_plan();
+}
+
+void FftSliding::release() {
+    cl_mem* buffers[] = {&_ring, &_window, &_hop_buf, &_spectrum, &_exact_buf};
+
+    for (auto buffer : buffers) {
+        if (NULL != *buffer) {
+            clReleaseMemObject(*buffer);
+            *buffer = NULL;
+        }
+    }
+    if (0 != _plan) {
+        clfftDestroyPlan(&_plan);
+        _plan = 0;
+    }
+    _slide.release();
+    _insert.release();
+    _linearize.release();
+}
+
+bool FftSliding::setup_plan() {
+    cl_int err = 0;
+    cl_command_queue queue = _fft.get_queue();
+    
+    err = clfftCreateDefaultPlan(&_plan, _fft.get_context(), CLFFT_1D, &_size);
+    CHECK("clfftCreateDefaultPlan");
+
+    err = clfftSetPlanPrecision(_plan, CLFFT_SINGLE);
+    CHECK("clfftSetPlanPrecision");
+    err = clfftSetLayout(_plan, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
+    CHECK("clfftSetLayout");
+    err = clfftSetResultLocation(_plan, CLFFT_OUTOFPLACE);
+    CHECK("clfftSetResultLocation");
+
+    err = clfftBakePlan(_plan, 1, &queue, NULL, NULL);
+    CHECK("clfftBakePlan");
+
+    return true;
+}
+
+bool FftSliding::update(const cl_float* samples) {
+    cl_int err = 0;
+    cl_command_queue queue = _fft.get_queue();
+    cl_uint n     = _size;
+    cl_uint head  = _head;
+    cl_uint count = _hop;
+    size_t  bins  = get_bins();
+
+    // only the hop crosses the bus
+    err = clEnqueueWriteBuffer(queue, _hop_buf, CL_TRUE, 0, _hop * sizeof(cl_float),
+                               samples, 0, NULL, NULL);
+    CHECK("clEnqueueWriteBuffer hop");
+
+    _slide.set_arg(0, _spectrum);
+    _slide.set_arg(1, _ring);
+    _slide.set_arg(2, _hop_buf);
+    _slide.set_arg(3, n);
+    _slide.set_arg(4, head);
+    _slide.set_arg(5, count);
+    err = clEnqueueNDRangeKernel(queue, _slide.kernel(), 1, NULL, &bins, NULL, 0, NULL, NULL);
+    CHECK("clEnqueueNDRangeKernel slide");
+
+    _insert.set_arg(0, _ring);
+    _insert.set_arg(1, _hop_buf);
+    _insert.set_arg(2, n);
+    _insert.set_arg(3, head);
+    err = clEnqueueNDRangeKernel(queue, _insert.kernel(), 1, NULL, &_hop, NULL, 0, NULL, NULL);
+    CHECK("clEnqueueNDRangeKernel insert");
+
+    _head = (_head + _hop) % _size;
+
+    if (0 < _refresh && 0 == ++_updates % _refresh)
+        return refresh();
+    return true;
+}
+
+bool FftSliding::read(cl_float* bins) {
+    cl_int err = clEnqueueReadBuffer(_fft.get_queue(), _spectrum, CL_TRUE, 0, 
+                                     get_bins() * 2 * sizeof(cl_float), bins, 0, NULL, NULL);
+    CHECK("clEnqueueReadBuffer spectrum");
+    return true;
+}
+
+// Full transform of the window: measures the drift and resets the state
+bool FftSliding::refresh() {
+    cl_int err = 0;
+    cl_command_queue queue = _fft.get_queue();
+    cl_uint n    = _size;
+    cl_uint head = _head;
+    size_t  bytes = get_bins() * 2 * sizeof(cl_float);
+
+    _linearize.set_arg(0, _window);
+    _linearize.set_arg(1, _ring);
+    _linearize.set_arg(2, n);
+    _linearize.set_arg(3, head);
+    err = clEnqueueNDRangeKernel(queue, _linearize.kernel(), 1, NULL, &_size, NULL, 0, NULL, NULL);
+    CHECK("clEnqueueNDRangeKernel linearize");
+
+    err = clfftEnqueueTransform(_plan, CLFFT_FORWARD, 1, &queue, 0, NULL, NULL,
+                                &_window, &_exact_buf, NULL);
+    CHECK("clfftEnqueueTransform");
+
+    err = clEnqueueReadBuffer(queue, _spectrum, CL_FALSE, 0, bytes, _approx.data(), 0, NULL, NULL);
+    CHECK("clEnqueueReadBuffer spectrum");
+    err = clEnqueueReadBuffer(queue, _exact_buf, CL_TRUE, 0, bytes, _exact.data(), 0, NULL, NULL);
+    CHECK("clEnqueueReadBuffer exact");
+
+    err = clEnqueueCopyBuffer(queue, _exact_buf, _spectrum, 0, 0, bytes, 0, NULL, NULL);
+    CHECK("clEnqueueCopyBuffer");
+
+    _drift = _exact.signal_to_quant_error(_approx);
+    _worst_drift = std::min(_worst_drift, _drift);
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef __FftSliding_hh
+#define __FftSliding_hh
+
+#include <clFFT.h>
+
+#include "fftjob.hh"
+#include "fftkernel.hh"
+
+class Fft;
+
+// Sliding DFT over the last N samples, for spectra updated every few samples.
+//
+// The window and its N/2 + 1 bins live on the device. Each update uploads
+// only the hop and applies X_k = (X_k - x_old + x_new) * e^(j2pi k/N) per
+// sample. Every `refresh` hops a full transform of the window replaces the
+// state; the SQER of the slid bins against it is the drift. The window must
+// be a fast size, the refresh plan is not padded.
+
+class FftSliding {
+
+public:
+    FftSliding(Fft& fft, size_t hop, int refresh);
+    ~FftSliding();
+
+    bool        init();
+    void        release();
+
+    bool        update(const cl_float* samples);
+    bool        read(cl_float* bins);
+    bool        refresh();
+
+    size_t      get_bins()                  { return _size / 2 + 1; }
+    size_t      get_hop()                   { return _hop; }
+    double      get_drift()                 { return _drift; }
+    double      get_worst_drift()           { return _worst_drift; }
+
+private:
+    bool        setup_plan();
+
+private:
+    Fft&            _fft;
+    size_t          _size;
+    size_t          _hop;
+    int             _refresh;
+    int             _updates;
+    size_t          _head;
+
+    cl_mem          _ring;
+    cl_mem          _window;
+    cl_mem          _hop_buf;
+    cl_mem          _spectrum;
+    cl_mem          _exact_buf;
+    clfftPlanHandle _plan;
+
+    FftKernel       _slide;
+    FftKernel       _insert;
+    FftKernel       _linearize;
+
+    FftJob          _exact;
+    FftJob          _approx;
+    double          _drift;
+    double          _worst_drift;
+};
+
+#endif // __FftSliding_hh
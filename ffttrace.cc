@@ -0,0 +1,142 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <set>
+#include <utility>
+
+#include "ffttrace.hh"
+
+using namespace std::chrono;
+
+FftTrace::FftTrace(size_t capacity)
+  : _epoch(steady_clock::now()),
+    _events(std::max(capacity, (size_t) 1)),
+    _next(0),
+    _recorded(0)
+{
+}
+
+int64_t FftTrace::now() {
+    return duration_cast<nanoseconds>(steady_clock::now() - _epoch).count();
+}
+
+// small stable ids for the host tracks, in order of first use
+int FftTrace::host_thread() {
+    static std::atomic<int> next(0);
+    thread_local int id = next++;
+    return id;
+}
+
+void FftTrace::host(const char* name, int64_t begin) {
+    span(name, 0, host_thread(), begin, now());
+}
+
+void FftTrace::span(const char* name, int pid, int tid, int64_t begin, int64_t end) {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    Event& event = _events[_next];
+    event.name     = name;
+    event.pid      = pid;
+    event.tid      = tid;
+    event.begin    = begin;
+    event.duration = end - begin;
+
+    _next = (_next + 1) % _events.size();
+    ++_recorded;
+}
+
+void FftTrace::device(const char* name, int lane, int slot, cl_event first, cl_event last,
+                      int64_t offset) {
+    cl_ulong start = 0;
+    cl_ulong end   = 0;
+
+    if (CL_SUCCESS != clGetEventProfilingInfo(first, CL_PROFILING_COMMAND_START,
+                                              sizeof(start), &start, NULL) ||
+        CL_SUCCESS != clGetEventProfilingInfo(last, CL_PROFILING_COMMAND_END,
+                                              sizeof(end), &end, NULL))
+        return;
+
+    int64_t begin  = (int64_t) start + offset;
+    int64_t finish = (int64_t) end + offset;
+    span(name, lane + 1, 0, begin, finish);
+    span(name, lane + 1, slot + 1, begin, finish);
+}
+
+// Offset taking device profiling time to trace time: the end of an empty
+// marker is taken to fall halfway through the host's wait for it.
+int64_t FftTrace::calibrate(cl_command_queue queue) {
+    cl_event marker = 0;
+    cl_ulong end    = 0;
+
+    int64_t before = now();
+    if (CL_SUCCESS != clEnqueueMarkerWithWaitList(queue, 0, NULL, &marker))
+        return 0;
+    clWaitForEvents(1, &marker);
+    int64_t after = now();
+
+    cl_int err = clGetEventProfilingInfo(marker, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    clReleaseEvent(marker);
+    if (CL_SUCCESS != err)
+        return 0;
+
+    return before + (after - before) / 2 - (int64_t) end;
+}
+
+size_t FftTrace::get_dropped() {
+    return _recorded > _events.size() ? _recorded - _events.size() : 0;
+}
+
+static void write_name(FILE* out, const char* kind, int pid, int tid, const std::string& name) {
+    fprintf(out, "{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+            kind, pid, tid, name.c_str());
+}
+
+bool FftTrace::write(const std::string& path) {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    FILE* out = fopen(path.c_str(), "w");
+    if (NULL == out) {
+        std::cerr << "Error: cannot write trace " << path << std::endl;
+        return false;
+    }
+
+    size_t count = std::min(_recorded, _events.size());
+    size_t first = _recorded > _events.size() ? _next : 0;
+
+    // name the tracks that appear
+    std::set<std::pair<int, int>> tracks;
+    for (size_t i = 0; i < count; ++i) {
+        const Event& event = _events[(first + i) % _events.size()];
+        tracks.insert(std::make_pair(event.pid, event.tid));
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    int last_pid = -1;
+    for (auto& track : tracks) {
+        int pid = track.first;
+        int tid = track.second;
+
+        if (pid != last_pid) {
+            write_name(out, "process_name", pid, 0, 0 == pid ? "host" : "lane " + std::to_string(pid - 1));
+            last_pid = pid;
+        }
+        if (0 == pid)
+            write_name(out, "thread_name", pid, tid, "thread " + std::to_string(tid));
+        else if (0 == tid)
+            write_name(out, "thread_name", pid, tid, "queue");
+        else
+            write_name(out, "thread_name", pid, tid, "slot " + std::to_string(tid - 1));
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const Event& event = _events[(first + i) % _events.size()];
+        fprintf(out, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                event.name, event.pid, event.tid, event.begin / 1000.0, event.duration / 1000.0,
+                i + 1 < count ? "," : "");
+    }
+
+    fprintf(out, "]}\n");
+    return 0 == fclose(out);
+}
@@ -0,0 +1,77 @@
+#ifndef __FftTrace_hh
+#define __FftTrace_hh
+
+#include <clFFT.h>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline of host and device activity written as Chrome trace-event JSON,
+// viewable in chrome://tracing or ui.perfetto.dev.
+//
+// Events go into a fixed ring of plain records, so a soak run keeps the
+// most recent window for the cost of a clock read and a short lock per
+// event. Device spans come from OpenCL profiling timestamps, read once a
+// slot's commands are complete and shifted onto the host clock by an
+// offset measured per lane when its queue is created.
+//
+// Tracks: process 0 holds one track per host thread, process lane+1 holds
+// the lane's queue (every command in issue order) and one track per slot.
+
+class FftTrace {
+
+public:
+    FftTrace(size_t capacity);
+
+    // ns since the trace was created
+    int64_t     now();
+
+    void        host(const char* name, int64_t begin);
+    void        span(const char* name, int pid, int tid, int64_t begin, int64_t end);
+
+    // device span from the start of first to the end of last
+    void        device(const char* name, int lane, int slot, cl_event first, cl_event last,
+                       int64_t offset);
+    int64_t     calibrate(cl_command_queue queue);
+
+    bool        write(const std::string& path);
+
+    size_t      get_recorded()              { return _recorded; }
+    size_t      get_dropped();
+
+    static int  host_thread();
+
+    // Host span covering the enclosing scope, nothing when trace is NULL
+    class Span {
+    public:
+        Span(FftTrace* trace, const char* name)
+          : _trace(trace), _name(name), _begin(trace ? trace->now() : 0) {}
+        ~Span() { if (_trace) _trace->host(_name, _begin); }
+
+    private:
+        FftTrace*   _trace;
+        const char* _name;
+        int64_t     _begin;
+    };
+
+private:
+    struct Event {
+        const char* name;
+        int32_t     pid;
+        int32_t     tid;
+        int64_t     begin;
+        int64_t     duration;
+    };
+
+private:
+    std::chrono::steady_clock::time_point _epoch;
+
+    std::mutex          _lock;
+    std::vector<Event>  _events;
+    size_t              _next;
+    size_t              _recorded;
+};
+
+#endif // __FftTrace_hh
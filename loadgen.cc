@@ -0,0 +1,181 @@
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "fftclient.hh"
+
+using namespace std;
+using namespace chrono;
+
+namespace po = boost::program_options;
+
+// Load generator for the FFT service: each client thread keeps `depth`
+// requests in flight in its own slot array and records the latency of every one.
+
+struct ClientResult {
+    bool                ok;
+    vector<double>      latency;        // μs
+};
+
+void run_client(const string& path, size_t size, int depth, long requests, 
+                ClientResult& result) {
+
+    result.ok = false;
+    // padded lengths need larger slots, the server knows its policy
+    FftClient client(path);
+    if (!client.open())
+        return;
+    size_t slot_size = client.capacity(size);
+    if (0 == slot_size) {
+        cerr << "Server cannot transform size " << size << endl;
+        return;
+    }
+    if (!client.attach(depth, slot_size))
+        return;
+
+    // template data, refilled into a slot before each request
+    vector<float> data(size);
+    default_random_engine            generator(random_device{}());
+    normal_distribution<float>       distribution(0.5, 0.2);
+    for (auto& value : data)
+        value = distribution(generator);
+
+    vector<high_resolution_clock::time_point> submitted(depth);
+    result.latency.reserve(requests);
+
+    long sent = 0;
+    for (int slot = 0; slot < depth && sent < requests; ++slot, ++sent) {
+        memcpy(client.slot(slot), data.data(), size * sizeof(float));
+        submitted[slot] = high_resolution_clock::now();
+        if (!client.submit(slot, size, true, slot))
+            return;
+    }
+
+    for (long done = 0; done < requests; ++done) {
+        FftResponse response;
+        if (!client.complete(response) || FftResponse::OK != response.status)
+            return;
+
+        auto finish = high_resolution_clock::now();
+        result.latency.push_back(
+            duration_cast<nanoseconds>(finish - submitted[response.slot]).count() / 1000.0);
+
+        if (sent < requests) {
+            memcpy(client.slot(response.slot), data.data(), size * sizeof(float));
+            submitted[response.slot] = high_resolution_clock::now();
+            if (!client.submit(response.slot, size, true, response.slot))
+                return;
+            ++sent;
+        }
+    }
+
+    result.ok = true;
+}
+
+int main(int ac, char* av[]) {
+
+    string  path        = FFT_SERVICE_SOCKET;
+    size_t  fft_size    = 8192;
+    int     clients     = 4;
+    int     depth       = 4;
+    long    count       = 10000;
+
+    try {
+        po::options_description desc("Allowed options");
+
+        desc.add_options()
+        ("help,h",         "Produce help message")
+        ("socket,S",       po::value<string>(), "Server socket [" FFT_SERVICE_SOCKET "]")
+        ("size,s",         po::value<int>(), "Set the size of the buffer [8192]")
+        ("clients,n",      po::value<int>(), "Concurrent clients, one slot array each [4]")
+        ("depth,q",        po::value<int>(), "Requests in flight per client [4]")
+        ("loops,l",        po::value<long>(), "Requests per client [10000]");
+
+        po::variables_map vm;
+        po::store(po::parse_command_line(ac, av, desc), vm);
+        po::notify(vm);
+
+        if (vm.count("help")) {
+            cout << desc << "\n";
+            return 1;
+        }
+
+        if (vm.count("socket")) {
+            path = vm["socket"].as<string>();
+        }
+
+        if (vm.count("size")) {
+            fft_size = vm["size"].as<int>();
+        }
+
+        if (vm.count("clients")) {
+            clients = vm["clients"].as<int>();
+        }
+
+        if (vm.count("depth")) {
+            depth = vm["depth"].as<int>();
+        }
+
+        if (vm.count("loops")) {
+            count = vm["loops"].as<long>();
+        }
+
+    } catch (exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    } catch (...) {
+        cerr << "Unknown error" << endl;
+        return 1;
+    }
+
+    vector<ClientResult> results(clients);
+    vector<thread>       threads;
+
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for (int i = 0; i < clients; ++i)
+        threads.push_back(thread(run_client, path, fft_size, depth, count, ref(results[i])));
+    for (auto& t : threads)
+        t.join();
+    high_resolution_clock::time_point finish = high_resolution_clock::now();
+
+    vector<double> latency;
+    for (auto& result : results) {
+        if (!result.ok) {
+            cerr << "Client failed" << endl;
+            return 1;
+        }
+        latency.insert(latency.end(), result.latency.begin(), result.latency.end());
+    }
+    if (latency.empty())
+        return 1;
+    sort(latency.begin(), latency.end());
+
+    double seconds = duration_cast<nanoseconds>(finish - start).count() / 1e9;
+    double mean = 0;
+    for (auto value : latency)
+        mean += value;
+    mean /= latency.size();
+
+    cout.precision(6);
+    cout << "Clients:    " << clients << endl;
+    cout << "Depth:      " << depth << endl;
+    cout << "Requests:   " << latency.size() << endl;
+    cout << "Data size:  " << fft_size << endl;
+    cout << endl;
+    cout << "Time:       " << seconds << " s" << endl;
+    cout << "Throughput: " << (latency.size() / seconds) << " req/s (" 
+         << (latency.size() * fft_size / seconds / 1e6) << " Msamples/s)" << endl;
+    cout << "Latency:    mean " << mean << " μs, p50 " 
+         << latency[latency.size() / 2] << " μs, p99 " 
+         << latency[latency.size() * 99 / 100] << " μs, max " 
+         << latency.back() << " μs" << endl;
+
+    return 0;
+}
@@ -2,12 +2,19 @@
 
 #include <clFFT.h>
 
+#include <csignal>
 #include <cstdlib>
 #include <chrono>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <sys/stat.h>
  
 #include "fft.hh"
+#include "fftgraph.hh"
+#include "fftoutofcore.hh"
+#include "fftserver.hh"
+#include "fftsliding.hh"
 
 using namespace std;
 using namespace chrono;
@@ -18,16 +25,85 @@ const char* _data_file_name = "fft-data.txt";
 const char* _fft_file_name  = "fft-forward.txt";
 const char* _bak_file_name  = "fft-backward.txt";
 
+Fft::Transfer _transfer     = Fft::FLOAT;
+bool          _pack_output  = false;
+Fft::Fission  _fission      = Fft::NONE;
+int           _fission_units = 0;
+Fft::Policy   _policy       = Fft::PAD;
+string        _cache_dir    = FftCache::default_dir();
+FftTrace*     _trace        = NULL;
+FftMetrics*   _metrics      = NULL;
+long          _mem_budget   = -1;
+
+// apply the tuning options shared by all modes, before Fft::init()
+void configure(Fft& fft) {
+    fft.set_transfer(_transfer, _pack_output);
+    fft.set_fission(_fission, _fission_units);
+    fft.set_policy(_policy);
+    fft.set_cache(_cache_dir);
+    fft.set_trace(_trace);
+    fft.set_metrics(_metrics);
+    if (0 <= _mem_budget)
+        fft.set_mem_budget(0 == _mem_budget ? SIZE_MAX : (size_t) _mem_budget << 20);
+}
+
+void report_startup(double startup_ms, bool warm) {
+    cout << "Startup:    " << startup_ms << " ms (" 
+         << (warm ? "warm" : "cold") << ")" << endl;
+}
+
+string describe_plan(Fft& fft) {
+    string plan = to_string(fft.get_plan_size());
+    if (fft.is_padded())
+        return plan + " (zero padded)";
+    if (fft.is_bluestein())
+        return plan + " (Bluestein)";
+    return plan + " (direct)";
+}
+
+string format_bytes(double bytes) {
+    ostringstream text;
+    if (bytes < (1 << 20))
+        text << (long) round(bytes / 1024) << " KB";
+    else
+        text << std::fixed << std::setprecision(1) << bytes / (1 << 20) << " MB";
+    return text.str();
+}
+
+string describe_memory(Fft& fft) {
+    size_t used = fft.get_slots() * fft.get_slot_bytes() + fft.get_shared_bytes();
+
+    string memory = to_string(fft.get_slots()) + " slots x " + format_bytes(fft.get_slot_bytes()) + 
+                    " + " + format_bytes(fft.get_shared_bytes()) + " shared = " + 
+                    format_bytes(used) + " of " + format_bytes(fft.get_device_memory());
+    if (0 != fft.get_mem_budget() && SIZE_MAX != fft.get_mem_budget())
+        memory += " (budget " + format_bytes(fft.get_mem_budget()) + ")";
+    return memory;
+}
+
+void report_transfer() {
+    cout << "Transfer:   ";
+    switch (_transfer) {
+    case Fft::FLOAT: cout << "Float"; break;
+    case Fft::HALF:  cout << "Half";  break;
+    case Fft::INT16: cout << "Int16"; break;
+    }
+    if (_pack_output)
+        cout << " (half readback)";
+    cout << endl;
+}
+
 void test_fft(size_t size, Fft::Device device, FftJob::TestData test_data, 
 		      int parallel, long count, double mean, double std) {
 
     Fft fft(size, device, parallel);
+    configure(fft);
     if (!fft.init()) {
         fft.shutdown();
         return;
     }
     
-    FftJob job(size, mean, std);
+    FftJob job(size, mean, std, fft.get_job_capacity());
     job.populate(test_data);
     job.write(_data_file_name);
 
@@ -45,13 +121,16 @@ void test_fft(size_t size, Fft::Device device, FftJob::TestData test_data,
     // cleanup
 }
 
-void inverse_fft(size_t size, Fft::Device device,  FftJob::TestData test_data, 
-	             int parallel, long count, double mean, double std) {
+// false when the round trip loses the signal, e.g. a compressed transfer
+// overflowing, so scripts can check it
+bool inverse_fft(size_t size, Fft::Device device,  FftJob::TestData test_data, 
+	             int parallel, long count, double mean, double std, double min_sqer) {
 
     Fft fft(size, device, parallel);
+    configure(fft);
     if (!fft.init()) {
         fft.shutdown();
-        return;
+        return false;
     }
     
     FftJob data(size, mean, std);
@@ -60,7 +139,7 @@ void inverse_fft(size_t size, Fft::Device device,  FftJob::TestData test_data,
     data.write(_data_file_name);
     
     // perform fft
-    FftJob forward(size, mean, std);
+    FftJob forward(size, mean, std, fft.get_job_capacity());
     forward.copy(data); // we need to preserve the original data - in place clobbers it
     fft.forward(forward);
     fft.wait_all();
@@ -68,7 +147,7 @@ void inverse_fft(size_t size, Fft::Device device,  FftJob::TestData test_data,
     forward.write_hermitian(_fft_file_name);
     
     // buffer for inversion
-    FftJob reverse(size, mean, std);
+    FftJob reverse(size, mean, std, fft.get_job_capacity());
     reverse.copy(forward);
     
     // reverse
@@ -79,12 +158,24 @@ void inverse_fft(size_t size, Fft::Device device,  FftJob::TestData test_data,
     
     cout << "FFT/IFFT computed." << endl;
     cout << "Data saved." << endl;
+    report_startup(fft.get_startup_time(), fft.is_warm_start());
+    cout << "Plan size:  " << describe_plan(fft) << endl;
+    cout << "Memory:     " << describe_memory(fft) << endl;
+    report_transfer();
     cout << "Root Mean Square :              " << std::setprecision(4) 
         << data.rms(reverse) << endl;
+    double sqer = data.signal_to_quant_error(reverse);
     cout << "Signal to Quantinization Error: " << std::setprecision(4) 
-        << data.signal_to_quant_error(reverse) << endl;
+        << sqer << endl;
     
     fft.shutdown();
+
+    // NaN or inf anywhere makes the SQER NaN or -inf
+    if (!(sqer >= min_sqer)) {
+        cerr << "Error: round trip SQER below " << min_sqer << " dB" << endl;
+        return false;
+    }
+    return true;
 }
 
 void inverse_fft_loop(size_t size, Fft::Device device,  FftJob::TestData test_data, 
@@ -92,6 +183,7 @@ void inverse_fft_loop(size_t size, Fft::Device device,  FftJob::TestData test_da
 
 
     Fft fft(size, device, parallel);
+    configure(fft);
     if (!fft.init()) {
         fft.shutdown();
         return;
@@ -103,23 +195,29 @@ void inverse_fft_loop(size_t size, Fft::Device device,  FftJob::TestData test_da
     for (int l = 0; l < count; ++l) {
     
         FftJob data(size, mean, std);
-        data.populate(test_data);
+        {
+            FftTrace::Span span(_trace, "populate");
+            data.populate(test_data);
+        }
         
         // perform fft
-        FftJob forward(size, mean, std);
+        FftJob forward(size, mean, std, fft.get_job_capacity());
         forward.copy(data); // we need to preserve the original data - in place clobbers it
         fft.forward(forward);
         fft.wait_all();
         
         // buffer for inversion
-        FftJob reverse(size, mean, std);
+        FftJob reverse(size, mean, std, fft.get_job_capacity());
         reverse.copy(forward);
         
         // reverse
         fft.backward(reverse);
         fft.wait_all();
 
-        sqer += data.signal_to_quant_error(reverse);
+        {
+            FftTrace::Span span(_trace, "metrics");
+            sqer += data.signal_to_quant_error(reverse);
+        }
         
         // update user
         int percent = (int) round((double) l / (double) count * 100.0);
@@ -131,6 +229,10 @@ void inverse_fft_loop(size_t size, Fft::Device device,  FftJob::TestData test_da
     }
         
     sqer /= (double) count;
+    double startup = fft.get_startup_time();
+    bool   warm    = fft.is_warm_start();
+    string plan    = describe_plan(fft);
+    string memory  = describe_memory(fft);
     
     cerr << "\r100 %" << endl;
     cout << endl;
@@ -140,9 +242,13 @@ void inverse_fft_loop(size_t size, Fft::Device device,  FftJob::TestData test_da
     else
         cout << "GPU" << endl;
     cout << "Precision:  Single" << endl;
+    report_startup(startup, warm);
+    report_transfer();
     cout << "Parallel:   " << parallel << endl;
     cout << "Iterations: " << count << endl;
     cout << "Data size:  " << size << endl;
+    cout << "Plan size:  " << plan << endl;
+    cout << "Memory:     " << memory << endl;
     cout << "Data type:  ";
     if (FftJob::PERIODIC) {
         cout << "Periodic" << endl;
@@ -157,20 +263,102 @@ void inverse_fft_loop(size_t size, Fft::Device device,  FftJob::TestData test_da
     fft.shutdown();
 }
 
+// The same round trip as one graph submission: nothing but the input and
+// two sums crosses the bus
+void inverse_graph_loop(size_t size, Fft::Device device, FftJob::TestData test_data, 
+                        long count, double mean, double std) {
+
+    Fft fft(size, device, 1);
+    configure(fft);
+    if (!fft.init()) {
+        fft.shutdown();
+        return;
+    }
+
+    FftJob   data(size, mean, std);
+    cl_float energy = 0;
+    cl_float error  = 0;
+
+    FftGraph graph(fft);
+    FftGraph::Node input = graph.upload(data.data(), size);
+    FftGraph::Node trip  = graph.backward(graph.forward(input));
+    graph.download(graph.sum_squares(input), &energy);
+    graph.download(graph.sum_squares(trip, input), &error);
+    if (!graph.compile()) {
+        graph.release();
+        fft.shutdown();
+        return;
+    }
+
+    double sqer = 0;
+    int last_percent = -1;
+
+    for (int l = 0; l < count; ++l) {
+        {
+            FftTrace::Span span(_trace, "populate");
+            data.populate(test_data);
+        }
+
+        if (!graph.run())
+            break;
+        sqer += 10.0 * log10(energy / error);
+
+        // update user
+        int percent = (int) round((double) l / (double) count * 100.0);
+        if (percent != last_percent) {
+            cerr << "\r" << percent << " %";
+            cerr.flush();
+            last_percent = percent;
+        } 
+    }
+
+    sqer /= (double) count;
+
+    cerr << "\r100 %" << endl;
+    cout << endl;
+    cout << "Hardware:   ";
+    if (Fft::CPU == device)
+        cout << "CPU" << endl;
+    else
+        cout << "GPU" << endl;
+    cout << "Precision:  Single" << endl;
+    report_startup(fft.get_startup_time(), fft.is_warm_start());
+    cout << "Iterations: " << count << endl;
+    cout << "Data size:  " << size << endl;
+    cout << "Graph:      " << graph.get_buffers() << " buffers, " 
+         << format_bytes(graph.get_bytes()) << (graph.is_concurrent() ? ", concurrent" : ", in order") 
+         << endl;
+    cout << "Data type:  ";
+    if (FftJob::PERIODIC == test_data) {
+        cout << "Periodic" << endl;
+    } else {
+        cout << "Random" << endl;
+        cout << "Mean:      " << mean << endl;
+        cout << "Std:       " << std << endl;
+    }   
+    cout << "Ave Signal to Quantinization Error: " << std::setprecision(4) 
+        << sqer << endl;
+
+    graph.release();
+    fft.shutdown();
+}
+
 void time_fft(size_t size, Fft::Device device, FftJob::TestData test_data, 
 	      int parallel, long count, double mean, double std) {
 
     cout << "Timing..." << endl;
 
     Fft fft(size, device, parallel);
+    configure(fft);
     if (!fft.init()) {
         fft.shutdown();
         return;
     }
 
+    // job memory comes from the lane that will run it
     vector<FftJob*> jobs;
     for (int i = 0; i < parallel; ++i) {
-        jobs.push_back(new FftJob(size, mean, std));
+        jobs.push_back(fft.create_job(mean, std));
     }
     
     nanoseconds total_duration(0);
@@ -179,8 +367,11 @@ void time_fft(size_t size, Fft::Device device, FftJob::TestData test_data,
     for (int outer = 0; outer < count; outer += parallel) {
         
         // randomize data
-        for (auto job : jobs) {
-            job->populate(test_data);
+        {
+            FftTrace::Span span(_trace, "populate");
+            for (auto job : jobs) {
+                job->populate(test_data);
+            }
         }
             
         // start timer
@@ -210,6 +401,14 @@ void time_fft(size_t size, Fft::Device device, FftJob::TestData test_data,
         }
     }
     
+    int    partitions = fft.get_partitions();
+    double startup    = fft.get_startup_time();
+    bool   warm       = fft.is_warm_start();
+    string plan       = describe_plan(fft);
+    string memory     = describe_memory(fft);
+    for (auto job : jobs) {
+        delete job;
+    }
     fft.shutdown();
     
     // report time
@@ -224,9 +423,14 @@ void time_fft(size_t size, Fft::Device device, FftJob::TestData test_data,
     else
         cout << "GPU" << endl;
     cout << "Precision:  Single" << endl;
+    report_startup(startup, warm);
+    report_transfer();
     cout << "Parallel:   " << parallel << endl;
+    cout << "Partitions: " << partitions << endl;
     cout << "Iterations: " << count << endl;
     cout << "Data size:  " << size << endl;
+    cout << "Plan size:  " << plan << endl;
+    cout << "Memory:     " << memory << endl;
     cout << "Data type:  ";
     if (FftJob::PERIODIC) {
         cout << "Periodic" << endl;
@@ -240,18 +444,419 @@ void time_fft(size_t size, Fft::Device device, FftJob::TestData test_data,
     cout << "Average:    " << ave << " ns (" << (ave / 1000.0) << " μs)" << endl;  
 }
 
+void out_of_core_fft(const string& input, const string& output, 
+                     Fft::Device device, size_t block_mb) {
+
+    // the passes are not padded, refuse lengths clFFT cannot plan
+    struct stat st;
+    if (0 != stat(input.c_str(), &st)) {
+        cerr << "Error: unable to stat " << input << endl;
+        return;
+    }
+    size_t length = st.st_size / sizeof(cl_float);
+    if (!Fft::is_fast_size(length)) {
+        cerr << "Error: out-of-core length " << length << " must be a product of 2, 3, 5 and 7" << endl;
+        return;
+    }
+
+    // only the OpenCL context is needed, the plans are sized per pass
+    Fft fft(0, device, 0);
+    configure(fft);
+    if (!fft.init_cl()) {
+        fft.shutdown();
+        return;
+    }
+
+    FftOutOfCore ooc(fft, block_mb << 20);
+
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    bool ok = ooc.transform(input, output);
+    high_resolution_clock::time_point finish = high_resolution_clock::now();
+
+    fft.shutdown();
+
+    if (!ok)
+        return;
+
+    auto ms = duration_cast<milliseconds>(finish - start).count();
+
+    cout << "Hardware:   ";
+    if (Fft::CPU == device)
+        cout << "CPU" << endl;
+    else
+        cout << "GPU" << endl;
+    cout << "Precision:  Single" << endl;
+    cout << "Data size:  " << ooc.get_size() << endl;
+    cout << "Layout:     " << ooc.get_rows() << " x " << ooc.get_cols() << endl;
+    cout << "Blocks:     " << ooc.get_col_batch() << " columns, " 
+         << ooc.get_row_batch() << " rows" << endl;
+    cout << "Spectrum:   " << output << endl;
+    cout << endl;
+    cout << "Time:       " << ms << " ms" << endl;
+    if (0 < ms)
+        cout << "Throughput: " << (ooc.get_size() / 1000.0 / ms) << " Msamples/s" << endl;
+}
+
+// average ns per forward transform, `parallel` jobs in flight
+double time_transforms(Fft& fft, FftJob::TestData test_data, int parallel, long count, 
+                       double mean, double std) {
+
+    vector<FftJob*> jobs;
+    for (int i = 0; i < parallel; ++i) {
+        jobs.push_back(fft.create_job(mean, std));
+    }
+
+    nanoseconds total_duration(0);
+    for (long outer = 0; outer < count; outer += parallel) {
+        {
+            FftTrace::Span span(_trace, "populate");
+            for (auto job : jobs) {
+                job->populate(test_data);
+            }
+        }
+
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        for (auto job : jobs) {
+            fft.forward(*job);
+        }
+        fft.wait_all();
+        total_duration += duration_cast<nanoseconds>(high_resolution_clock::now() - start);
+    }
+
+    for (auto job : jobs) {
+        delete job;
+    }
+    return total_duration.count() / (double) count;
+}
+
+bool is_prime(size_t n) {
+    if (n < 2)
+        return false;
+    for (size_t d = 2; d * d <= n; ++d) {
+        if (0 == n % d)
+            return false;
+    }
+    return true;
+}
+
+// cost against length: powers of two, other fast sizes, awkward composites and primes
+void sweep_fft(size_t max_size, Fft::Device device, FftJob::TestData test_data, 
+               int parallel, long count, double mean, double std) {
+
+    cout << left << setw(11) << "Length" << setw(10) << "Kind" << setw(11) << "Policy"
+         << setw(11) << "Plan" << setw(14) << "ns/FFT" << "ns/sample" << endl;
+
+    for (size_t p = 256; p <= max_size; p *= 2) {
+        size_t prime = p + 1;
+        while (!is_prime(prime))
+            ++prime;
+
+        vector<pair<size_t, const char*>> lengths = {
+            {p, "pow2"}, {p + p / 2, "fast"}, {p - 1, "composite"}, {prime, "prime"}};
+
+        for (auto& length : lengths) {
+            bool fast = Fft::is_fast_size(length.first);
+
+            for (auto policy : {Fft::PAD, Fft::BLUESTEIN}) {
+                if (fast && Fft::BLUESTEIN == policy)
+                    continue;
+
+                Fft fft(length.first, device, parallel);
+                configure(fft);
+                fft.set_policy(policy);
+                if (!fft.init()) {
+                    fft.shutdown();
+                    continue;
+                }
+
+                double ns = time_transforms(fft, test_data, parallel, count, mean, std);
+                const char* name = fast ? "direct" : (Fft::PAD == policy ? "pad" : "bluestein");
+
+                cout << setw(11) << length.first << setw(10) << length.second << setw(11) << name
+                     << setw(11) << fft.get_plan_size() << setw(14) << std::setprecision(6) << ns
+                     << (ns / length.first) << endl;
+
+                fft.shutdown();
+            }
+        }
+    }
+    cout << right;
+}
+
+// Interleaved blocks run as one strided batch, against deinterleaving on the
+// host into a job per channel
+void channels_fft(size_t size, Fft::Device device, FftJob::TestData test_data, int parallel, 
+                  long count, int channels, int stride, double mean, double std) {
+
+    cout << "Timing..." << endl;
+
+    Fft strided(size, device, parallel);
+    configure(strided);
+    strided.set_channels(channels, stride);
+    if (!strided.init()) {
+        strided.shutdown();
+        return;
+    }
+    stride = strided.get_stride();
+
+    vector<FftJob*> blocks;
+    for (int i = 0; i < parallel; ++i) {
+        blocks.push_back(strided.create_job(mean, std));
+    }
+
+    nanoseconds strided_duration(0);
+    for (long outer = 0; outer < count; outer += parallel) {
+        {
+            FftTrace::Span span(_trace, "populate");
+            for (auto block : blocks) {
+                block->populate(test_data);
+            }
+        }
+
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        for (auto block : blocks) {
+            strided.forward(*block);
+        }
+        strided.wait_all();
+        strided_duration += duration_cast<nanoseconds>(high_resolution_clock::now() - start);
+    }
+
+    string plan   = describe_plan(strided);
+    string memory = describe_memory(strided);
+    for (auto block : blocks) {
+        delete block;
+    }
+    strided.shutdown();
+
+    // the same blocks, one contiguous job per channel
+    Fft single(size, device, parallel * channels);
+    configure(single);
+    if (!single.init()) {
+        single.shutdown();
+        return;
+    }
+
+    vector<FftJob*> raw;
+    vector<FftJob*> jobs;
+    for (int i = 0; i < parallel; ++i) {
+        raw.push_back(new FftJob(size, mean, std, size * stride));
+        raw.back()->set_layout(channels, stride);
+        for (int c = 0; c < channels; ++c) {
+            jobs.push_back(single.create_job(mean, std));
+        }
+    }
+
+    nanoseconds host_duration(0);
+    for (long outer = 0; outer < count; outer += parallel) {
+        {
+            FftTrace::Span span(_trace, "populate");
+            for (auto block : raw) {
+                block->populate(test_data);
+            }
+        }
+
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        for (int i = 0; i < parallel; ++i) {
+            const cl_float* frames = raw[i]->data();
+            for (int c = 0; c < channels; ++c) {
+                FftJob* job = jobs[i * channels + c];
+                cl_float* samples = job->data();
+                {
+                    FftTrace::Span span(_trace, "deinterleave");
+                    for (size_t t = 0; t < size; ++t) {
+                        samples[t] = frames[t * stride + c];
+                    }
+                }
+                single.forward(*job);
+            }
+        }
+        single.wait_all();
+        host_duration += duration_cast<nanoseconds>(high_resolution_clock::now() - start);
+    }
+
+    for (auto job : jobs) {
+        delete job;
+    }
+    for (auto block : raw) {
+        delete block;
+    }
+    single.shutdown();
+
+    double strided_ave = strided_duration.count() / (double) count;
+    double host_ave    = host_duration.count() / (double) count;
+
+    cout.precision(8);
+    cout << endl;
+    cout << "Hardware:   ";
+    if (Fft::CPU == device)
+        cout << "CPU" << endl;
+    else
+        cout << "GPU" << endl;
+    cout << "Precision:  Single" << endl;
+    report_transfer();
+    cout << "Parallel:   " << parallel << endl;
+    cout << "Iterations: " << count << endl;
+    cout << "Data size:  " << size << endl;
+    cout << "Plan size:  " << plan << endl;
+    cout << "Memory:     " << memory << endl;
+    cout << "Channels:   " << channels << " (stride " << stride << ")" << endl;
+    cout << endl;
+    cout << "Strided:      " << strided_ave << " ns per block (" 
+         << (strided_ave / channels) << " ns per channel)" << endl;
+    cout << "Deinterleave: " << host_ave << " ns per block (" 
+         << (host_ave / channels) << " ns per channel)" << endl;
+    cout << "Speedup:      " << (host_ave / strided_ave) << endl;
+}
+
+// average ns per hop of a sliding update plus spectrum readback
+double time_sliding(Fft& fft, FftJob& stream, size_t hop, long count, int refresh, 
+                    double* drift, double* worst) {
+
+    FftSliding sliding(fft, hop, refresh);
+    if (!sliding.init())
+        return -1;
+
+    vector<cl_float> bins(sliding.get_bins() * 2);
+    size_t offset = 0;
+
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for (long l = 0; l < count; ++l) {
+        if (stream.size() < (int) (offset + hop))
+            offset = 0;
+        if (!sliding.update(stream.data() + offset) || !sliding.read(bins.data()))
+            return -1;
+        offset += hop;
+    }
+    high_resolution_clock::time_point finish = high_resolution_clock::now();
+
+    if (NULL != drift) {
+        *drift = sliding.get_drift();
+        *worst = sliding.get_worst_drift();
+    }
+    return duration_cast<nanoseconds>(finish - start).count() / (double) count;
+}
+
+void sliding_fft(size_t size, Fft::Device device, FftJob::TestData test_data, 
+                 size_t hop, long count, int refresh, double mean, double std) {
+
+    if (!Fft::is_fast_size(size)) {
+        cerr << "Error: sliding window " << size << " must be a product of 2, 3, 5 and 7, "
+             << "try " << Fft::next_fast_size(size) << endl;
+        return;
+    }
+
+    Fft fft(size, device, 1);
+    configure(fft);
+    if (!fft.init()) {
+        fft.shutdown();
+        return;
+    }
+
+    FftJob stream(size, mean, std);
+    stream.populate(test_data);
+
+    // full path: re-upload and transform the whole window every hop
+    FftJob window(size, mean, std, fft.get_job_capacity());
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for (long l = 0; l < count; ++l) {
+        window.copy(stream);
+        fft.forward(window);
+        fft.wait_all();
+    }
+    high_resolution_clock::time_point finish = high_resolution_clock::now();
+    double full = duration_cast<nanoseconds>(finish - start).count() / (double) count;
+
+    double drift = 0;
+    double worst = 0;
+    double slide = time_sliding(fft, stream, hop, count, refresh, &drift, &worst);
+    if (slide < 0) {
+        fft.shutdown();
+        return;
+    }
+
+    // smallest power of two hop where sliding stops paying off
+    size_t crossover = 0;
+    long   probe     = std::min(count, 100L);
+    for (size_t h = 1; h <= size && 0 == crossover; h *= 2) {
+        double t = time_sliding(fft, stream, h, probe, 0, NULL, NULL);
+        if (t < 0 || full <= t)
+            crossover = h;
+    }
+
+    fft.shutdown();
+
+    cout.precision(8);
+    cout << "Hardware:   ";
+    if (Fft::CPU == device)
+        cout << "CPU" << endl;
+    else
+        cout << "GPU" << endl;
+    cout << "Precision:  Single" << endl;
+    cout << "Data size:  " << size << endl;
+    cout << "Hop:        " << hop << endl;
+    cout << "Refresh:    every " << refresh << " hops" << endl;
+    cout << "Updates:    " << count << endl;
+    cout << endl;
+    cout << "Sliding:    " << slide << " ns/hop" << endl;
+    cout << "Full FFT:   " << full << " ns/hop" << endl;
+    if (0 < refresh && refresh <= count)
+        cout << "Drift SQER: " << drift << " (worst " << worst << ")" << endl;
+    else
+        cout << "Drift SQER: not measured, no refresh" << endl;
+    if (0 != crossover)
+        cout << "Crossover:  hop " << crossover << endl;
+    else
+        cout << "Crossover:  none, sliding is faster up to hop " << size << endl;
+}
+
+void serve_fft(const string& path, const vector<size_t>& sizes, Fft::Device device, 
+               int parallel) {
+
+    FftServer server(path, device, parallel, configure);
+
+    // bake every served size up front, requests for any other are refused
+    for (auto size : sizes) {
+        if (!server.warm(size))
+            return;
+    }
+
+    signal(SIGINT,  [](int) { FftServer::stop(); });
+    signal(SIGTERM, [](int) { FftServer::stop(); });
+
+    cout << "Serving on " << path << endl;
+    server.run();
+    server.shutdown();
+}
+
 int main(int ac, char* av[]) {
 
     size_t              fft_size        = 8192;
     Fft::Device         device          = Fft::GPU;
     FftJob::TestData    test_data       = FftJob::RANDOM;
     bool                inverse         = false;
+    double              min_sqer        = 20;
     bool                inverse_loop    = false;
     bool                time            = false;
     int                 parallel        = 16;
     long                count           = 1000;
     double              mean            = 0.5;
     double              std             = 0.2;
+    string              ooc_input;
+    string              ooc_output      = "fft-spectrum.bin";
+    size_t              ooc_block       = 64;
+    string              serve;
+    string              serve_sizes;
+    size_t              hop             = 0;
+    int                 refresh         = 64;
+    bool                sweep           = false;
+    bool                graph           = false;
+    int                 channels        = 1;
+    int                 channel_stride  = 0;
+    string              trace;
+    size_t              trace_events    = 1 << 20;
+    string              metrics_file;
+    string              metrics_socket;
+    double              metrics_interval = 5;
 
     try {
         
@@ -260,11 +865,38 @@ int main(int ac, char* av[]) {
         desc.add_options()
         ("help,h",         "Produce help message")
         ("cpu,c",          "Force CPU usage")
+        ("fission",        po::value<string>(), "Partition the device: numa, l3 or equal:<units>")
 
         ("inverse,i",      "Perform an FFT, then an inverse FFT on the same buffer")
         ("inverse-loop,v", "Compute average SQER")
+        ("min-sqer",       po::value<double>(), "Fail --inverse below this SQER in dB [20]")
+        ("graph",          "Run the --inverse-loop round trip as one device graph")
         ("time,t",         "Time the FFT operation")
+        ("sweep",          "Time forward transforms over lengths up to --size, including primes")
+        ("channels",       po::value<int>(), "Time interleaved channels as one strided batch against host deinterleaving")
+        ("channel-stride", po::value<int>(), "Floats per interleaved frame [channels]")
+        ("policy",         po::value<string>(), "Lengths clFFT cannot run: pad or bluestein [pad]")
+        ("out-of-core,o",  po::value<string>(), "FFT of a raw cl_float file larger than device memory")
+        ("ooc-output",     po::value<string>(), "Output file for the out-of-core spectrum [fft-spectrum.bin]")
+        ("ooc-block",      po::value<long>(), "Device MB for out-of-core blocks, both stages [64]")
+        ("sliding",        po::value<int>(), "Sliding DFT with the given hop size")
+        ("refresh",        po::value<int>(), "Full transforms between sliding updates [64]")
+        ("serve",          po::value<string>()->implicit_value(FFT_SERVICE_SOCKET),
+                           "Run as a server on a Unix socket [" FFT_SERVICE_SOCKET "]")
+        ("serve-sizes",    po::value<string>(), "Comma separated sizes the server accepts [--size]")
         
+        ("cache-dir",      po::value<string>(), "Compiled kernel cache directory [~/.cache/clfft-test]")
+        ("no-cache",       "Always compile kernels")
+        ("transfer",       po::value<string>(), "Host/device transfer format: float, half or int16 [float]")
+        ("pack-output",    "Read results back as half precision")
+        ("mem-budget",     po::value<long>()->implicit_value(0),
+                           "Device MB for buffer slots, fit as many as --jobs allows [device memory]")
+        ("trace",          po::value<string>(), "Write a Chrome trace-event timeline to this file")
+        ("trace-events",   po::value<int>(), "Most recent events kept for --trace [1048576]")
+        ("metrics",        po::value<string>(), "Rewrite Prometheus metrics to this file every interval")
+        ("metrics-socket", po::value<string>(), "Serve Prometheus metrics on this Unix socket")
+        ("metrics-interval", po::value<double>(), "Seconds between metrics file updates [5]")
+
         ("periodic,p",     "Use a periodic data set")
         ("random,r",       "Use a gaussian distributed random data set")
         ("mean,m",         po::value<double>(), "Mean for random data")
@@ -287,18 +919,148 @@ int main(int ac, char* av[]) {
             device = Fft::CPU;
         }
         
+        if (vm.count("fission")) {
+            string fission = vm["fission"].as<string>();
+            if ("numa" == fission) {
+                _fission = Fft::NUMA;
+            } else if ("l3" == fission) {
+                _fission = Fft::L3;
+            } else if (0 == fission.find("equal:")) {
+                _fission = Fft::EQUAL;
+                _fission_units = stoi(fission.substr(6));
+            } else {
+                cerr << "Error: unknown fission " << fission << endl;
+                return 1;
+            }
+        }
+
         if (vm.count("inverse")) {
             inverse = true;
         }
         
+        if (vm.count("min-sqer")) {
+            min_sqer = vm["min-sqer"].as<double>();
+        }
+
         if (vm.count("inverse-loop")) {
             inverse_loop = true;
         }
         
+        if (vm.count("graph")) {
+            graph = true;
+        }
+
         if (vm.count("time")) {
             time = true;
         }
         
+        if (vm.count("out-of-core")) {
+            ooc_input = vm["out-of-core"].as<string>();
+        }
+
+        if (vm.count("ooc-output")) {
+            ooc_output = vm["ooc-output"].as<string>();
+        }
+
+        if (vm.count("ooc-block")) {
+            long block = vm["ooc-block"].as<long>();
+            if (block <= 0) {
+                cerr << "Error: --ooc-block must be a positive number of MB" << endl;
+                return 1;
+            }
+            ooc_block = block;
+        }
+        
+        if (vm.count("sweep")) {
+            sweep = true;
+        }
+
+        if (vm.count("channels")) {
+            channels = vm["channels"].as<int>();
+        }
+
+        if (vm.count("channel-stride")) {
+            channel_stride = vm["channel-stride"].as<int>();
+        }
+
+        if (vm.count("policy")) {
+            string policy = vm["policy"].as<string>();
+            if ("pad" == policy) {
+                _policy = Fft::PAD;
+            } else if ("bluestein" == policy) {
+                _policy = Fft::BLUESTEIN;
+            } else {
+                cerr << "Error: unknown policy " << policy << endl;
+                return 1;
+            }
+        }
+
+        if (vm.count("sliding")) {
+            hop = vm["sliding"].as<int>();
+        }
+
+        if (vm.count("refresh")) {
+            refresh = vm["refresh"].as<int>();
+        }
+
+        if (vm.count("serve")) {
+            serve = vm["serve"].as<string>();
+        }
+
+        if (vm.count("serve-sizes")) {
+            serve_sizes = vm["serve-sizes"].as<string>();
+        }
+
+        if (vm.count("cache-dir")) {
+            _cache_dir = vm["cache-dir"].as<string>();
+        }
+
+        if (vm.count("no-cache")) {
+            _cache_dir.clear();
+        }
+
+        if (vm.count("transfer")) {
+            string transfer = vm["transfer"].as<string>();
+            if ("float" == transfer) {
+                _transfer = Fft::FLOAT;
+            } else if ("half" == transfer) {
+                _transfer = Fft::HALF;
+            } else if ("int16" == transfer) {
+                _transfer = Fft::INT16;
+            } else {
+                cerr << "Error: unknown transfer format " << transfer << endl;
+                return 1;
+            }
+        }
+
+        if (vm.count("pack-output")) {
+            _pack_output = true;
+        }
+
+        if (vm.count("mem-budget")) {
+            _mem_budget = vm["mem-budget"].as<long>();
+        }
+
+        if (vm.count("trace")) {
+            trace = vm["trace"].as<string>();
+        }
+
+        if (vm.count("trace-events")) {
+            trace_events = vm["trace-events"].as<int>();
+        }
+
+        if (vm.count("metrics")) {
+            metrics_file = vm["metrics"].as<string>();
+        }
+
+        if (vm.count("metrics-socket")) {
+            metrics_socket = vm["metrics-socket"].as<string>();
+        }
+
+        if (vm.count("metrics-interval")) {
+            metrics_interval = vm["metrics-interval"].as<double>();
+        }
+
         if (vm.count("periodic")) {
         	test_data = FftJob::PERIODIC;
         }
@@ -338,14 +1100,75 @@ int main(int ac, char* av[]) {
     // to nearest 16
     count = ((int) ceil(count / parallel)) * parallel;
 
-    if (inverse)
-        inverse_fft(fft_size, device, test_data, parallel, count, mean, std);
+    if (hop > fft_size) {
+        cerr << "Error: hop larger than the window" << endl;
+        return 1;
+    }
+
+    vector<size_t> sizes;
+    if (serve_sizes.empty())
+        sizes.push_back(fft_size);
+    stringstream size_list(serve_sizes);
+    string       item;
+    while (getline(size_list, item, ',')) {
+        char*  end  = NULL;
+        size_t size = strtoul(item.c_str(), &end, 10);
+        if (0 == size || '\0' != *end) {
+            cerr << "Error: bad size in --serve-sizes: " << item << endl;
+            return 1;
+        }
+        sizes.push_back(size);
+    }
+
+    if (!trace.empty())
+        _trace = new FftTrace(trace_events);
+
+    if (!metrics_file.empty() || !metrics_socket.empty()) {
+        _metrics = new FftMetrics();
+        if (!_metrics->start(metrics_file, metrics_socket, metrics_interval)) {
+            delete _metrics;
+            return 1;
+        }
+    }
+
+    bool ok = true;
+    if (!serve.empty())
+        serve_fft(serve, sizes, device, parallel);
+    else if (sweep)
+        sweep_fft(fft_size, device, test_data, parallel, count, mean, std);
+    else if (0 != hop)
+        sliding_fft(fft_size, device, test_data, hop, count, refresh, mean, std);
+    else if (!ooc_input.empty())
+        out_of_core_fft(ooc_input, ooc_output, device, ooc_block);
+    else if (1 < channels || channels < channel_stride)
+        channels_fft(fft_size, device, test_data, parallel, count, channels, channel_stride, mean, std);
+    else if (inverse)
+        ok = inverse_fft(fft_size, device, test_data, parallel, count, mean, std, min_sqer);
+    else if (inverse_loop && graph)
+        inverse_graph_loop(fft_size, device, test_data, count, mean, std);
     else if (inverse_loop)
         inverse_fft_loop(fft_size, device, test_data, parallel, count, mean, std);
     else if (time)    
         time_fft(fft_size, device, test_data, parallel, count, mean, std);
     else
         test_fft(fft_size, device, test_data, parallel, count, mean, std);
+
+    if (NULL != _trace) {
+        if (_trace->write(trace)) {
+            cout << "Trace:      " << trace << " (" << _trace->get_recorded() << " events";
+            if (0 != _trace->get_dropped())
+                cout << ", oldest " << _trace->get_dropped() << " dropped";
+            cout << ")" << endl;
+        }
+        delete _trace;
+    }
+
+    if (NULL != _metrics) {
+        _metrics->stop();
+        if (!metrics_file.empty())
+            cout << "Metrics:    " << metrics_file << endl;
+        delete _metrics;
+    }
     
-    return 0;
+    return ok ? 0 : 1;
 }